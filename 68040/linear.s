@@ -8,7 +8,9 @@
 
 _Aud_MixPacket_040Linear::
 Aud_MixPacket_040Linear:
-        movem.l d2-d6/a2-a4,-(sp)
+        movem.l d2-d7/a2-a4,-(sp)
+
+        addq.l  #1,am_PacketCount_l(a0)
 
         ; Number of lines to mix in d6
         move.w  am_PacketSize_w(a0),d6
@@ -16,25 +18,32 @@ Aud_MixPacket_040Linear:
         subq.w  #1,d6
 
 
-        ; Reset the working pointers
+        ; Reset the working pointers. These are in Chip RAM, or the Fast RAM staging buffer for staged output
         lea     am_LPacketSamplePtr_l(a0),a1
-        lea     am_LPacketSampleBasePtr_l(a0),a2
+        lea     am_LPacketSampleWriteBasePtr_l(a0),a2
         move.l  (a2)+,(a1)+
         move.l  (a2)+,(a1)+
         move.l  (a2)+,(a1)+
         move.l  (a2)+,(a1)+
 
+        ; Byte offset of the current line within the normalisation group in d7
+        moveq   #0,d7
+
 .mix_next_line:
 
 ;
 ; Initialisation - clear out the accumulation buffers
 ;
 .clear_accum_buffers:
-        move.w  #CACHE_LINE_SIZE-1,d2
+        moveq   #(CACHE_LINE_SIZE/2)-1,d2
         lea     am_AccumL_vw(a0),a1
+        adda.w  d7,a1
+        lea     am_AccumR_vw(a0),a2
+        adda.w  d7,a2
 
 .clear_loop:
         clr.l   (a1)+
+        clr.l   (a2)+
         dbra    d2,.clear_loop
 
 ;
@@ -80,7 +89,8 @@ Aud_MixPacket_040Linear:
 
         ; Two step loop. The first iteration handles the left channel, the second iteration handles the right
         moveq   #1,d3
-        lea     am_AccumL_vw(a0),a4 ; note that the right accumulator immediately follows
+        lea     am_AccumL_vw(a0),a4 ; mixed at the offset of the current line within the group
+        adda.w  d7,a4
         clr.l   d0
 
 ;
@@ -124,7 +134,10 @@ Aud_MixPacket_040Linear:
         dbra    d1,.mix_next_sample
 
 .mix_next_buffer:
-        ; Now do the second step for the opposite side...
+        ; Now do the second step for the opposite side. The accumulator pointer is only advanced when the left
+        ; volume is non-zero, so set it explicitly.
+        lea     am_AccumR_vw(a0),a4
+        adda.w  d7,a4
         lsr.w   #8,d5
         dbra    d3,.mix_samples
 
@@ -146,140 +159,20 @@ Aud_MixPacket_040Linear:
         dbra    d2,.next_channel
 
 
-; Peak Level Analysis - Find the peak level of the left and right accumulation buffers so that we can normalise
-;                       each one and convert to 8-bit data with a corresponding chanenel volume attenuation.
-;
-        ; Now we need to find the maximum absolute value of each accumulation buffer
-        lea     am_AccumL_vw(a0),a4
-        lea     am_AbsMaxL_w(a0),a2
-
-        ; Same two-step trick as before, we process left then right consecutively
-        moveq  #1,d3
-
-        ; Peak value / 512 gives us our normalisation index
-        moveq  #9,d4
-
-.next_buffer:
-        clr.w   d0 ; d0 will contain the next absolute value from the buffer
-        clr.l   d2
-        moveq  #CACHE_LINE_SIZE-1,d1
-
-.next_buffer_value:
-        move.w  (a4)+,d0
-        bge.s   .not_negative
-
-        neg.w   d0
-
-.not_negative:
-        cmp.w   d0,d2
-        bgt.s   .not_bigger
-
-        move.w  d0,d2
-
-.not_bigger:
-        dbra    d1,.next_buffer_value
-
-        ; peak value (15 bit) - we don't really need to store this but it's just for checking
-        move.w  d2,(a2)+
-
-        ; Now determine the normalisation factor. This is just the 15-bit absolute peak >> 9
-        ; which gives us our offset into the _Aud_NormFactors_vw table
-        lsr.w   d4,d2
-        move.w  d2,2(a2)
-
-        dbra    d3,.next_buffer
-
-; Normalisation - For each 16-bit value in the accumulation buffer, scale by the normalisation value and then
-;                 convert to 8 bit.
-
-        ; Same two-step trick as before, we process left then right consecutively
-        moveq  #1,d3
-
-        lea     am_AccumL_vw(a0),a2
-        lea     am_IndexL_w(a0),a3
-        lea     am_LPacketSamplePtr_l(a0),a4
-
-.normalize_next:
-        ; get the table index into d1. If the index is on less than a power of 2, we will be using a shift method
-        moveq   #1,d0
-        move.w  (a3),d1                ; Index that we calculated in the analysis step
-        lea     _Aud_NormFactors_vw,a1
-        move.w  (a1,d1.w*2),d2         ; d2 contains normalisation factor
-
-        move.l  4(a4),a1               ; volume packet pointer in a1
-        add.w   d1,d0                  ; i + 1
-        move.w  d0,(a1)+               ; write volume value
+; Normalisation - Peak level analysis and conversion of the accumulated group to 8-bit are performed by the
+;                 shared normalisation stage, once the last line of the group has been mixed. Advances d7.
 
-        move.l  a1,4(a4)               ; updated working volume pointer
+        jsr     Aud_OutputLine
 
-        moveq   #(CACHE_LINE_SIZE/4)-1,d4 ; we are converting 4 samples per loop
-
-        move.l (a4),a1                    ; destination ptr in a1
-
-        ; Check for a perfoect power of 2..
-        and.w   d1,d0                  ; (i + 1) & i
-        beq     .shift_norm_four  ;
-
-.mul_norm_four:
-        ; something like this, for 060
-        move.w  (a2)+,d0    ; xx:xx:AA:aa
-        muls.w  d2,d0       ; 00:AA:xx:xx
-        lsr.l   #8,d0       ; 00:00:AA:xx
-        move.w  d0,d1       ; xx:xx:AA:xx
-
-        move.w  (a2)+,d0    ; xx:xx:BB:bb
-        muls.w  d2,d0       ; xx:BB:xx:xx
-        swap    d0          ; xx:xx:xx:BB
-        move.b  d0,d1       ; xx:xx:AA:BB
-        lsl.l   #8,d1       ; xx:AA:BB:00
-
-        move.w  (a2)+,d0    ; xx:xx:CC:cc
-        muls.w  d2,d0       ; xx:CC:xx:xx
-        swap    d0          ; xx:xx:xx:CC
-        move.b  d0,d1       ; xx:AA:BB:CC
-        lsl.l   #8,d1       ; AA:BB:CC:00
-
-        move.w  (a2)+,d0    ; xx:xx:DD:dd
-        muls.w  d2,d0       ; xx:DD:xx:xx
-        swap    d0          ; xx:xx:xx:DD
-        move.b  d0,d1       ; AA:BB:CC:DD
-
-        move.l  d1,(a1)+    ; long slow chip write here
-
-        dbra    d4,.mul_norm_four
-
-        move.l  a1,(a4)     ; update working destination pointer
-
-        bra.s   .done_channel_normalise
-
-.shift_norm_four:
-
-        ; process samples in pairs
-
-        move.l  (a2)+,d0 ; AA:aa:BB:bb
-        lsr.l   d2,d0    ; 00:AA:xx:BB
-        move.l  (a2)+,d1 ; CC:cc:DD:dd
-        lsl.w   #8,d0    ; 00:AA:BB:00
-        lsr.l   d2,d1    ; xx:CC:xx:DD
-        lsl.l   #8,d0    ; AA:BB:00:00
-        lsl.w   #8,d1    ; xx:CC:DD:00
-        lsr.l   #8,d1    ; 00:xx:CC:DD
-        move.w  d1,d0    ; AA:BB:CC:DD
-        move.l  d0,(a1)+ ; long slow chip write
-
-        dbra    d4,.shift_norm_four
-
-        move.l  a1,(a4)     ; update working destination pointer
-
-.done_channel_normalise:
-        lea     2(a3),a3              ; next index
-        lea     8(a4),a4              ; next buffer pair
+        dbra    d6,.mix_next_line
 
-        dbra    d3,.normalize_next
+        ; Transfer the staged packet to Chip RAM
+        tst.b   am_UseStagedOutput_b(a0)
+        beq.s   .finished
 
-        dbra    d6,.mix_next_line
+        jsr     Aud_FlushStagedOutput
 
 .finished:
-        movem.l (sp)+,d2-d6/a2-a4
+        movem.l (sp)+,d2-d7/a2-a4
         rts
 
@@ -8,7 +8,9 @@
 
 _Aud_MixPacket_040Null::
 Aud_MixPacket_040Null:
-        movem.l d2-d6/a2-a4,-(sp)
+        movem.l d2-d7/a2-a4,-(sp)
+
+        addq.l  #1,am_PacketCount_l(a0)
 
         ; Number of lines to mix in d6
         move.w  am_PacketSize_w(a0),d6
@@ -16,25 +18,32 @@ Aud_MixPacket_040Null:
         subq.w  #1,d6
 
 
-        ; Reset the working pointers
+        ; Reset the working pointers. These are in Chip RAM, or the Fast RAM staging buffer for staged output
         lea     am_LPacketSamplePtr_l(a0),a1
-        lea     am_LPacketSampleBasePtr_l(a0),a2
+        lea     am_LPacketSampleWriteBasePtr_l(a0),a2
         move.l  (a2)+,(a1)+
         move.l  (a2)+,(a1)+
         move.l  (a2)+,(a1)+
         move.l  (a2)+,(a1)+
 
+        ; Byte offset of the current line within the normalisation group in d7
+        moveq   #0,d7
+
 .mix_next_line:
 
 ;
 ; Initialisation - clear out the accumulation buffers
 ;
 .clear_accum_buffers:
-        move.w  #CACHE_LINE_SIZE-1,d2
+        moveq   #(CACHE_LINE_SIZE/2)-1,d2
         lea     am_AccumL_vw(a0),a1
+        adda.w  d7,a1
+        lea     am_AccumR_vw(a0),a2
+        adda.w  d7,a2
 
 .clear_loop:
         clr.l   (a1)+
+        clr.l   (a2)+
         dbra    d2,.clear_loop
 
 ;
@@ -80,7 +89,8 @@ Aud_MixPacket_040Null:
 
         ; Two step loop. The first iteration handles the left channel, the second iteration handles the right
         moveq   #1,d3
-        lea     am_AccumL_vw(a0),a4 ; note that the right accumulator immediately follows
+        lea     am_AccumL_vw(a0),a4 ; mixed at the offset of the current line within the group
+        adda.w  d7,a4
         clr.l   d0
 
 ; No mixing ///////////////////////////////////////////////////////////////////////////////
@@ -102,39 +112,19 @@ Aud_MixPacket_040Null:
 
         dbra    d2,.next_channel
 
-        ; No normalisation.
+        ; No mixing, but the silent accumulation buffers are written out by the selected output stage so that
+        ; the cost of each output format can be isolated
+        jsr     Aud_OutputLine
 
-        ; chip writes - just push silence
+        dbra    d6,.mix_next_line
 
-        clr.l   d0
-        lea     am_LPacketSamplePtr_l(a0),a4
-        move.l  4(a4),a1               ; volume packet pointer in a1
-        move.w  d0,(a1)+               ; write volume value
-        move.l  a1,4(a4)               ; save pointer
-
-        move.l  (a4),a1                ; sample packet pointer in a1
-        move.l  d0,(a1)+
-        move.l  d0,(a1)+
-        move.l  d0,(a1)+
-        move.l  d0,(a1)+
-        move.l  a1,(a4)                ; save pointer
-
-
-        lea     am_RPacketSamplePtr_l(a0),a4
-        move.l  4(a4),a1               ; volume packet pointer in a1
-        move.w  d0,(a1)+               ; write volume value
-        move.l  a1,4(a4)               ; save pointer
-
-        move.l  (a4),a1                ; sample packet pointer in a1
-        move.l  d0,(a1)+
-        move.l  d0,(a1)+
-        move.l  d0,(a1)+
-        move.l  d0,(a1)+
-        move.l  a1,(a4)                ; save pointer
+        ; Transfer the staged packet to Chip RAM
+        tst.b   am_UseStagedOutput_b(a0)
+        beq.s   .finished
 
-        dbra    d6,.mix_next_line
+        jsr     Aud_FlushStagedOutput
 
 .finished:
-        movem.l (sp)+,d2-d6/a2-a4
+        movem.l (sp)+,d2-d7/a2-a4
         rts
 
@@ -9,6 +9,10 @@ $sRightVol  = file_get_contents('../rvol_out.raw');
 
 $iLimit = strlen($sLeftChan);
 
+// Normalisation group size, in samples per volume word. Must match the group size the mixer was created with.
+$iGroup = isset($argv[1]) ? (int)$argv[1] : 16;
+$iGroupMask = $iGroup - 1;
+
 $sOutput = '';
 
 $iLeftFactor = 0;
@@ -16,10 +20,11 @@ $iRightFactor = 0;
 
 for ($i = 0; $i < $iLimit; ++ $i) {
 
-	if (!($i & 0xF)) {
-		// Volume data is actually 16-bit words
-		$iLeftFactor  = 4 * ord($sLeftVol[1 + ($i >> 3)]);
-		$iRightFactor = 4 * ord($sRightVol[1 + ($i >> 3)]);
+	if (!($i & $iGroupMask)) {
+		// Volume data is actually 16-bit words, one per group
+		$iVolume      = 1 + 2 * intdiv($i, $iGroup);
+		$iLeftFactor  = 4 * ord($sLeftVol[$iVolume]);
+		$iRightFactor = 4 * ord($sRightVol[$iVolume]);
 	}
 	
 	$iLeftSample = ord($sLeftChan[$i]);
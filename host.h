@@ -0,0 +1,50 @@
+#ifndef _TKG_HOST_H_
+#define _TKG_HOST_H_
+
+/**
+ * Minimal stand-ins for the AmigaOS types and exec calls used by the mixer, so that the C parts can be built
+ * and run on a development host. Only included when AUD_HOST_BUILD is defined.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#define REG(reg, arg) arg
+
+typedef int8_t   BYTE;
+typedef uint8_t  UBYTE;
+typedef int16_t  WORD;
+typedef uint16_t UWORD;
+typedef int32_t  LONG;
+typedef uint32_t ULONG;
+typedef int16_t  BOOL;
+typedef void*    APTR;
+
+#ifndef TRUE
+#define TRUE  1
+#endif
+#ifndef FALSE
+#define FALSE 0
+#endif
+
+#define MEMF_ANY   0L
+#define MEMF_CHIP  (1L << 1)
+#define MEMF_FAST  (1L << 2)
+#define MEMF_CLEAR (1L << 16)
+
+static inline APTR AllocVec(ULONG size, ULONG flags)
+{
+    return (flags & MEMF_CLEAR) ? calloc(1, size) : malloc(size);
+}
+
+static inline void FreeVec(APTR address)
+{
+    free(address);
+}
+
+static inline void CopyMem(void const* source, APTR dest, ULONG size)
+{
+    memcpy(dest, source, size);
+}
+
+#endif
@@ -1,6 +1,9 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "mixer.h"
+#include "position.h"
 #include <proto/exec.h>
 #include <devices/timer.h>
 #include <proto/timer.h>
@@ -36,7 +39,7 @@ struct Device* get_timer(void) {
     }
     TimerBase = time_request.tr_node.io_Device;
     clock_freq_hz = ReadEClock(&clk_begin.ecv);
-    printf("Got Timer, tick frequency is %u Hz\n", clock_freq_hz);
+    printf("# Got Timer, tick frequency is %lu Hz\n", clock_freq_hz);
     return TimerBase;
 }
 
@@ -49,49 +52,156 @@ void free_timer(void) {
 
 extern UWORD asm_sizeof_mixer;
 
+// Largest sample we can play, since ac_SamplesLeft is a UWORD and must be a whole number of lines
+#define MAX_SOUND_LENGTH (0xFFFF & ~CACHE_ALIGN_MASK)
+#define MAX_SOUNDS 16
+#define SOUND_DIR "sounds"
+
 typedef struct {
     BYTE* s_dataPtr;
+    BYTE* s_encodedPtr; // L1D15 pre-encoded copy of s_dataPtr for kernels that expect it
     ULONG s_length;
+    char  s_name[32];
 } Sound;
 
-void load_sample(char const* file_name, Sound* sound)
+static Sound sounds[MAX_SOUNDS];
+static int   num_sounds = 0;
+
+void EncodeL1D15(BYTE* p_data, ULONG length) {
+    ULONG frames = length >> 4;
+    for (ULONG f = 0; f < frames; ++f) {
+        for (int i = 15; i > 0; --i) {
+            p_data[i] -= p_data[i - 1];
+        }
+        p_data += CACHE_LINE_SIZE;
+    }
+}
+
+BOOL load_sample(char const* file_name, Sound* sound)
 {
     FILE *file = fopen(file_name, "rb");
-    if (file) {
-        fseek(file, 0, SEEK_END);
-        size_t size = ftell(file) & 0xFFFF;
-        fseek(file, 0, SEEK_SET);
-
-        BYTE* alloc =  AllocCacheAligned(size, MEMF_FAST);
-        if (alloc) {
-            fread(alloc, 1, size, file);
-            printf("Loaded %s [%zu bytes] at %p\n", file_name, size, alloc);
-            sound->s_dataPtr = alloc;
-            sound->s_length  = CacheAlign(size);
-        }
+    if (!file) {
+        return FALSE;
+    }
+
+    fseek(file, 0, SEEK_END);
+    size_t size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    if (size > MAX_SOUND_LENGTH) {
+        size = MAX_SOUND_LENGTH;
+    }
+
+    sound->s_length     = CacheAlign(size);
+    sound->s_dataPtr    = AllocCacheAligned(sound->s_length, MEMF_FAST|MEMF_CLEAR);
+    sound->s_encodedPtr = AllocCacheAligned(sound->s_length, MEMF_FAST);
+
+    if (sound->s_dataPtr && sound->s_encodedPtr && size == fread(sound->s_dataPtr, 1, size, file)) {
+        CopyMem(sound->s_dataPtr, sound->s_encodedPtr, sound->s_length);
+        EncodeL1D15(sound->s_encodedPtr, sound->s_length);
+        printf("# Loaded %s [%zu bytes] at %p\n", file_name, size, sound->s_dataPtr);
         fclose(file);
+        return TRUE;
+    }
+
+    FreeCacheAligned(sound->s_dataPtr);
+    FreeCacheAligned(sound->s_encodedPtr);
+    sound->s_dataPtr    = NULL;
+    sound->s_encodedPtr = NULL;
+    fclose(file);
+    return FALSE;
+}
+
+/**
+ * Loads every .raw file in the sounds directory, so that the benchmark reflects the assets we actually mix.
+ */
+void load_sounds(void)
+{
+    BPTR lock = Lock(SOUND_DIR, ACCESS_READ);
+    struct FileInfoBlock* fib = (struct FileInfoBlock*)AllocDosObject(DOS_FIB, NULL);
+
+    if (lock && fib && Examine(lock, fib)) {
+        while (num_sounds < MAX_SOUNDS && ExNext(lock, fib)) {
+            size_t name_len = strlen(fib->fib_FileName);
+            if (
+                fib->fib_DirEntryType >= 0 ||
+                name_len < 5 ||
+                name_len >= sizeof(sounds[0].s_name) ||
+                0 != strcmp(fib->fib_FileName + name_len - 4, ".raw")
+            ) {
+                continue;
+            }
+            char path[sizeof(SOUND_DIR) + sizeof(sounds[0].s_name)];
+            snprintf(path, sizeof(path), SOUND_DIR "/%s", fib->fib_FileName);
+            if (load_sample(path, &sounds[num_sounds])) {
+                strcpy(sounds[num_sounds].s_name, fib->fib_FileName);
+                ++num_sounds;
+            }
+        }
+    }
+
+    if (fib) {
+        FreeDosObject(DOS_FIB, fib);
     }
+    if (lock) {
+        UnLock(lock);
+    }
+}
+
+void free_sounds(void)
+{
+    for (int i = 0; i < num_sounds; ++i) {
+        FreeCacheAligned(sounds[i].s_dataPtr);
+        FreeCacheAligned(sounds[i].s_encodedPtr);
+    }
+    num_sounds = 0;
 }
 
 enum {
     OPT_DUMP_BUFFERS=0,
     OPT_VERBOSE,
+    OPT_CSV,
+    OPT_BASELINE,
+    OPT_TOLERANCE,
+    OPT_PACKETS,
+    OPT_KERNEL,
+    OPT_GROUP,
     OPT_MAX
 };
 
-static LONG ra_Params[OPT_MAX] = { 0, 0, };
+#define DEF_TOLERANCE 5
+#define DEF_PACKETS 50
 
-static void parse_params(void) {
-    struct RDArgs* args = NULL;
-    if ( (args = (struct RDArgs *)AllocDosObject(DOS_RDARGS, NULL) )) {
-        if (ReadArgs("D=DUMPBUFFERS/S,V=VERBOSE/S", ra_Params, args)) {
-            FreeArgs(args);
+static LONG ra_Params[OPT_MAX] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+static struct RDArgs* ra_Args = NULL;
+
+static BOOL parse_params(void) {
+    if ( (ra_Args = (struct RDArgs *)AllocDosObject(DOS_RDARGS, NULL) )) {
+        if (ReadArgs(
+            "D=DUMPBUFFERS/S,V=VERBOSE/S,CSV/K,B=BASELINE/K,T=TOLERANCE/K/N,P=PACKETS/K/N,K=KERNEL/K,G=GROUP/K/N",
+            ra_Params,
+            ra_Args
+        )) {
+            return TRUE;
         }
-        FreeDosObject(DOS_RDARGS, args);
-        args = NULL;
+        FreeDosObject(DOS_RDARGS, ra_Args);
+        ra_Args = NULL;
+    }
+    return FALSE;
+}
+
+static void free_params(void) {
+    if (ra_Args) {
+        FreeArgs(ra_Args);
+        FreeDosObject(DOS_RDARGS, ra_Args);
+        ra_Args = NULL;
     }
 }
 
+static ULONG param_num(int option, ULONG def) {
+    return ra_Params[option] ? (ULONG)*((LONG*)ra_Params[option]) : def;
+}
+
 static FILE* db_LChanOut = NULL;
 static FILE* db_RChanOut = NULL;
 static FILE* db_LVolOut  = NULL;
@@ -120,17 +230,27 @@ static void close_dump(void) {
 }
 
 void dump_mixer(Aud_Mixer const* mixer) {
+    if (AUD_OUTPUT_PCM16 == mixer->am_OutputFormat) {
+        // Interleaved 16-bit frames go to the left channel file
+        if (db_LChanOut) {
+            fwrite(mixer->am_LeftPacketSampleBasePtr, 4, mixer->am_PacketSize, db_LChanOut);
+        }
+        return;
+    }
     if (db_LChanOut) {
         fwrite(mixer->am_LeftPacketSampleBasePtr, 1, mixer->am_PacketSize, db_LChanOut);
     }
     if (db_RChanOut) {
         fwrite(mixer->am_RightPacketSampleBasePtr, 1, mixer->am_PacketSize, db_RChanOut);
     }
+    if (AUD_OUTPUT_8BIT == mixer->am_OutputFormat) {
+        return;
+    }
     if (db_LVolOut) {
-        fwrite(mixer->am_LeftPacketVolumeBasePtr, 2, mixer->am_PacketSize >> 4, db_LVolOut);
+        fwrite(mixer->am_LeftPacketVolumeBasePtr, 2, mixer->am_PacketSize >> mixer->am_GroupShift, db_LVolOut);
     }
     if (db_RVolOut) {
-        fwrite(mixer->am_RightPacketVolumeBasePtr, 2, mixer->am_PacketSize >> 4, db_RVolOut);
+        fwrite(mixer->am_RightPacketVolumeBasePtr, 2, mixer->am_PacketSize >> mixer->am_GroupShift, db_RVolOut);
     }
 }
 
@@ -144,72 +264,395 @@ typedef void (*Mix_Function)(REG(a0, Aud_Mixer* mixer));
 
 typedef struct {
     Mix_Function mix_function;
+    char const*  name;
     char const*  mix_info;
     char const*  norm_info;
     char const*  extra_info;
+    BOOL         pre_encoded;
 } TestCase;
 
 static TestCase test_cases[] = {
 
     {
         Aud_MixPacket_040Null,
+        "040null",
         "None (data fectch only)",
-        "None (data write only)",
-        "Move16 fetch, target 68040/60"
+        "None (output stage only)",
+        "Move16 fetch, target 68040/60",
+        FALSE
+    },
+
+    {
+        Aud_MixPacket_C,
+        "c",
+        "Multiplication (C)",
+        "Multiplication/Shift (C)",
+        "Portable reference",
+        FALSE
     },
 
     {
         Aud_MixPacket_060,
+        "060",
         "Multiplication",
         "Multiplication/Shift",
-        "Move16 fetch, target 68060"
+        "Move16 fetch, target 68060",
+        FALSE
     },
 
     {
         Aud_MixPacket_040Shifted,
+        "040shifted",
         "Shift Only",
         "Multiplication/Shift",
-        "Move16 fetch, target 68040"
+        "Move16 fetch, target 68040",
+        FALSE
     },
 
     {
         Aud_MixPacket_040Linear,
+        "040linear",
         "Lookup",
         "Multiplication/Shift",
-        "Move16 fetch, target 68040/60"
+        "Move16 fetch, target 68040/60",
+        FALSE
     },
 
     {
         Aud_MixPacket_040Delta,
+        "040delta",
         "Delta Lookup",
         "Multiplication/Shift",
-        "Move16 fetch, target 68040/60"
+        "Move16 fetch, target 68040/60",
+        FALSE
     },
 
-    // Pre-encoded tests follow. The samples will be converted
+    // Pre-encoded tests follow. These mix from the L1D15 encoded copy of each sound
     {
         Aud_MixPacket_040PreDelta,
+        "040predelta",
         "Delta Lookup (Pre-encoded source)",
         "Multiplication/Shift",
-        "Move16 fetch, target 68040"
+        "Move16 fetch, target 68040",
+        TRUE
     },
 
 };
 
+#define NUM_TEST_CASES (sizeof(test_cases)/sizeof(TestCase))
+
+/**
+ * Benchmark matrix. Every combination of these is run for each kernel and each sound.
+ */
+static UWORD const bench_sample_rates[]   = { MIN_SAMPLE_RATE, 11025, 16000, MAX_SAMPLE_RATE };
+static UWORD const bench_update_rates[]   = { MIN_UPDATE_RATE, 25, 50, MAX_UPDATE_RATE };
+static UWORD const bench_group_sizes[]    = { AUD_MIN_GROUP_SIZE, 32, AUD_MAX_GROUP_SIZE };
+static UWORD const bench_channel_counts[] = { 1, 4, 8, AUD_NUM_CHANNELS };
+
+/**
+ * Output configurations. Paula HDR is measured writing directly to Chip RAM and via the Fast RAM staging buffer,
+ * and with the master gain fading from unity to oc_fadeGain over the run, so that the gain is never unity after the
+ * first group.
+ */
+typedef struct {
+    char const* oc_name;
+    UWORD       oc_format;
+    BOOL        oc_staged;
+    UWORD       oc_fadeGain;
+} OutputConfig;
+
+static OutputConfig const bench_outputs[] = {
+    { "direct", AUD_OUTPUT_PAULA_HDR, FALSE, AUD_UNITY_GAIN     },
+    { "staged", AUD_OUTPUT_PAULA_HDR, TRUE,  AUD_UNITY_GAIN     },
+    { "fade",   AUD_OUTPUT_PAULA_HDR, FALSE, AUD_UNITY_GAIN / 4 },
+    { "8bit",   AUD_OUTPUT_8BIT,      FALSE, AUD_UNITY_GAIN     },
+    { "pcm16",  AUD_OUTPUT_PCM16,     FALSE, AUD_UNITY_GAIN     },
+};
 
-void EncodeL1D15(Sound* p_sound) {
+#define ARRAY_SIZE(a) (sizeof(a)/sizeof(a[0]))
 
+/**
+ * Configurations the mixer could not be created for, listed again in the summary so that they are not missed
+ */
+typedef struct {
+    UWORD       sc_sampleRateHz;
+    UWORD       sc_updateRateHz;
+    UWORD       sc_groupSize;
+    char const* sc_output;
+} SkippedConfig;
+
+static SkippedConfig skipped_configs[
+    ARRAY_SIZE(bench_sample_rates) * ARRAY_SIZE(bench_update_rates) *
+    ARRAY_SIZE(bench_group_sizes) * ARRAY_SIZE(bench_outputs)
+];
+static ULONG num_skipped_configs = 0;
+
+/**
+ * Positional update. One emitter per channel, spread around the listener at a range of distances so that every
+ * part of the attenuation and pan tables is exercised. The listener moves along X a little each update. This does
+ * not depend on the kernel or the mixing configuration, so it is timed once, on a mixer of its own.
+ */
+#define BENCH_REF_DISTANCE     256
+#define BENCH_MAX_DISTANCE     4096
+#define BENCH_LISTENER_STEP    32
+#define BENCH_POSITION_RATE    16000
+#define BENCH_POSITION_UPDATES 1000
+
+static Aud_Emitter const bench_emitters[AUD_NUM_CHANNELS] = {
+    {   100,    50,  0, 15 }, {  -300,   200,  1, 12 }, {   600,  -400,  2, 15 }, {  -900,  -900,  3,  8 },
+    {  1500,   100,  4, 12 }, {   -50,  2000,  5, 15 }, {  2500, -2500,  6, 10 }, { -3000,   500,  7, 15 },
+    {     0,  -700,  8,  6 }, {   400,   400,  9, 15 }, { -1200,  1600, 10, 12 }, {  3500,  3500, 11, 15 },
+    {  -200,  -200, 12,  9 }, {   800,  1900, 13, 15 }, { -2200, -1000, 14, 12 }, {  5000,     0, 15, 15 },
+};
 
-    ULONG frames = p_sound->s_length >> 4;
-    BYTE *p_data = p_sound->s_dataPtr;
+/**
+ * Volume distributions. Each gives the left/right volume pair for each channel.
+ */
+typedef struct {
+    char const* vd_name;
+    UBYTE       vd_levels[AUD_NUM_CHANNELS][2];
+} VolumeDistribution;
 
-    printf("Preencoding sample data at %p, %lu frames...\n", p_data, frames);
-    for (ULONG f = 0; f < frames; ++f) {
-        for (int i = 15; i > 0; --i) {
-            p_data[i] -= p_data[i - 1];
+static VolumeDistribution const volume_distributions[] = {
+    {
+        "centre",
+        {
+            {12, 12}, {12, 12}, {12, 12}, {12, 12}, {12, 12}, {12, 12}, {12, 12}, {12, 12},
+            {12, 12}, {12, 12}, {12, 12}, {12, 12}, {12, 12}, {12, 12}, {12, 12}, {12, 12},
         }
-        p_data += CACHE_LINE_SIZE;
+    },
+    {
+        "hardpan",
+        {
+            {15,  0}, { 0, 15}, {15,  0}, { 0, 15}, {15,  0}, { 0, 15}, {15,  0}, { 0, 15},
+            {15,  0}, { 0, 15}, {15,  0}, { 0, 15}, {15,  0}, { 0, 15}, {15,  0}, { 0, 15},
+        }
+    },
+    {
+        "quiet",
+        {
+            {10,  8}, { 2,  1}, { 1,  3}, { 2,  2}, { 1,  1}, { 3,  1}, { 1,  2}, { 2,  3},
+            { 8, 10}, { 1,  1}, { 2,  1}, { 1,  2}, { 3,  2}, { 1,  1}, { 2,  1}, { 1,  3},
+        }
+    },
+};
+
+/**
+ * One row of benchmark results. This is also the CSV record layout.
+ */
+typedef struct {
+    char  br_kernel[16];
+    char  br_sound[32];
+    char  br_volumes[16];
+    char  br_output[8];
+    UWORD br_sampleRateHz;
+    UWORD br_updateRateHz;
+    UWORD br_groupSize;
+    UWORD br_channels;
+    ULONG br_packets;
+    ULONG br_ticks;
+    ULONG br_usPerPacket;
+    ULONG br_loadPermille;
+} BenchResult;
+
+#define CSV_HEADER "kernel,sound,rate,update,group,channels,volumes,output,packets,ticks,us_per_packet,load_permille\n"
+#define CSV_FORMAT "%s,%s,%hu,%hu,%hu,%hu,%s,%s,%lu,%lu,%lu,%lu\n"
+#define CSV_SCAN   "%15[^,],%31[^,],%hu,%hu,%hu,%hu,%15[^,],%7[^,],%lu,%lu,%lu,%lu"
+
+static BenchResult* baseline = NULL;
+static ULONG        baseline_size = 0;
+
+/**
+ * Loads a CSV file produced by a previous run, for regression checking.
+ */
+static BOOL load_baseline(char const* file_name)
+{
+    FILE* file = fopen(file_name, "r");
+    if (!file) {
+        return FALSE;
+    }
+
+    char        line[160];
+    ULONG       capacity = 0;
+    BenchResult row;
+    while (fgets(line, sizeof(line), file)) {
+        if (12 != sscanf(
+            line,
+            CSV_SCAN,
+            row.br_kernel,
+            row.br_sound,
+            &row.br_sampleRateHz,
+            &row.br_updateRateHz,
+            &row.br_groupSize,
+            &row.br_channels,
+            row.br_volumes,
+            row.br_output,
+            &row.br_packets,
+            &row.br_ticks,
+            &row.br_usPerPacket,
+            &row.br_loadPermille
+        )) {
+            // Header or garbage
+            continue;
+        }
+        if (baseline_size == capacity) {
+            capacity = capacity ? capacity << 1 : 256;
+            BenchResult* grown = (BenchResult*)realloc(baseline, capacity * sizeof(BenchResult));
+            if (!grown) {
+                break;
+            }
+            baseline = grown;
+        }
+        baseline[baseline_size++] = row;
+    }
+    fclose(file);
+    printf("# Loaded %lu baseline results from %s\n", baseline_size, file_name);
+    return TRUE;
+}
+
+static BenchResult const* find_baseline(BenchResult const* result)
+{
+    for (ULONG i = 0; i < baseline_size; ++i) {
+        BenchResult const* row = &baseline[i];
+        if (
+            row->br_sampleRateHz == result->br_sampleRateHz &&
+            row->br_updateRateHz == result->br_updateRateHz &&
+            row->br_groupSize    == result->br_groupSize &&
+            row->br_channels     == result->br_channels &&
+            0 == strcmp(row->br_kernel,  result->br_kernel) &&
+            0 == strcmp(row->br_sound,   result->br_sound) &&
+            0 == strcmp(row->br_volumes, result->br_volumes) &&
+            0 == strcmp(row->br_output,  result->br_output)
+        ) {
+            return row;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * (Re)start a channel on the given sound. Each channel starts at a different offset so that they do not all mix the
+ * same data in lockstep.
+ */
+static void start_channel(Aud_ChannelState* state, int chan, BYTE* data, ULONG length, UBYTE const* levels)
+{
+    ULONG offset = ((ULONG)chan << 5) % length;
+    state->ac_SamplePtr   = data + offset;
+    state->ac_SamplesLeft = (UWORD)(length - offset);
+    state->ac_LeftVolume  = levels[0];
+    state->ac_RightVolume = levels[1];
+}
+
+/**
+ * Mix a fixed number of packets with the given kernel, sound, channel count and volumes. Channels that run out
+ * are restarted between packets (outside of the timed region) so that the load is constant for the whole run.
+ */
+static void run_benchmark(
+    Aud_Mixer* mixer,
+    TestCase const* test,
+    OutputConfig const* output,
+    Sound const* sound,
+    UWORD num_channels,
+    VolumeDistribution const* volumes,
+    ULONG num_packets,
+    BenchResult* result
+) {
+    BYTE* data = test->pre_encoded ? sound->s_encodedPtr : sound->s_dataPtr;
+
+    for (int chan = 0; chan < AUD_NUM_CHANNELS; ++chan) {
+        Aud_ChannelState* state = &mixer->am_ChannelState[chan];
+        if (chan < num_channels) {
+            start_channel(state, chan, data, sound->s_length, volumes->vd_levels[chan]);
+        } else {
+            state->ac_SamplePtr   = NULL;
+            state->ac_SamplesLeft = 0;
+            state->ac_LeftVolume  = 0;
+            state->ac_RightVolume = 0;
+        }
+    }
+
+    Aud_SetMasterGain(mixer, AUD_UNITY_GAIN, 0);
+    Aud_SetMasterGain(mixer, output->oc_fadeGain, num_packets);
+
+    if (ra_Params[OPT_VERBOSE]) {
+        Aud_DumpMixer(mixer);
+    }
+
+    ULONG64 ticks = 0;
+    for (ULONG packet = 0; packet < num_packets; ++packet) {
+        time(test->mix_function(mixer));
+        ticks += clk_end.ticks - clk_begin.ticks;
+
+        if (ra_Params[OPT_DUMP_BUFFERS]) {
+            dump_mixer(mixer);
+        }
+
+        for (int chan = 0; chan < num_channels; ++chan) {
+            Aud_ChannelState* state = &mixer->am_ChannelState[chan];
+            if (!state->ac_SamplePtr) {
+                start_channel(state, 0, data, sound->s_length, volumes->vd_levels[chan]);
+            }
+        }
+    }
+
+    if (ra_Params[OPT_VERBOSE]) {
+        Aud_DumpMixer(mixer);
+    }
+
+    ULONG64 us = (ticks * 1000000) / clock_freq_hz;
+
+    strncpy(result->br_kernel,  test->name,       sizeof(result->br_kernel) - 1);
+    strncpy(result->br_sound,   sound->s_name,    sizeof(result->br_sound) - 1);
+    strncpy(result->br_volumes, volumes->vd_name, sizeof(result->br_volumes) - 1);
+    strncpy(result->br_output,  output->oc_name,  sizeof(result->br_output) - 1);
+    result->br_sampleRateHz = mixer->am_SampleRateHz;
+    result->br_updateRateHz = mixer->am_UpdateRateHz;
+    result->br_groupSize    = mixer->am_GroupSize;
+    result->br_channels     = num_channels;
+    result->br_packets      = num_packets;
+    result->br_ticks        = (ULONG)ticks;
+    result->br_usPerPacket  = (ULONG)(us / num_packets);
+
+    // Fraction of real time spent mixing: time per packet over the duration of a packet
+    result->br_loadPermille = (ULONG)((us * mixer->am_UpdateRateHz) / (num_packets * 1000));
+}
+
+/**
+ * Time a batch of positional updates, one emitter per channel, as the game would make before each packet. A single
+ * update is only a few EClock ticks, so the whole batch is timed and the mean reported in nanoseconds.
+ */
+static void run_position_benchmark(void)
+{
+    Aud_Mixer* mixer = Aud_CreateMixer(
+        BENCH_POSITION_RATE,
+        MIN_UPDATE_RATE,
+        AUD_DEFAULT_GROUP_SIZE,
+        AUD_OUTPUT_PAULA_HDR
+    );
+    if (!mixer || !Aud_SetPositionModel(mixer, BENCH_REF_DISTANCE, BENCH_MAX_DISTANCE)) {
+        puts("# Could not create a mixer with a position model, positional update not timed");
+        Aud_FreeMixer(mixer);
+        return;
+    }
+
+    Aud_Listener listener = { 0, 0, 0, AUD_POS_FACING_ONE };
+
+    ReadEClock(&clk_begin.ecv);
+    for (ULONG update = 0; update < BENCH_POSITION_UPDATES; ++update) {
+        listener.al_X = (WORD)(update * BENCH_LISTENER_STEP);
+        Aud_UpdatePositions(mixer, &listener, bench_emitters, AUD_NUM_CHANNELS);
     }
+    ReadEClock(&clk_end.ecv);
+
+    ULONG64 ticks = clk_end.ticks - clk_begin.ticks;
+    printf(
+        "# Positional update: %d emitters, %lu updates, %lu ticks, %lu ns per update\n",
+        AUD_NUM_CHANNELS,
+        (ULONG)BENCH_POSITION_UPDATES,
+        (ULONG)ticks,
+        (ULONG)((ticks * 1000000000ULL) / (clock_freq_hz * (ULONG64)BENCH_POSITION_UPDATES))
+    );
+    Aud_FreeMixer(mixer);
 }
 
 int main(void) {
@@ -227,93 +670,206 @@ int main(void) {
         return 20;
     }
 
-    parse_params();
-
-    Aud_Mixer* mixer = Aud_CreateMixer(16000, 50);
-
-    if (mixer) {
-        TimerBase = get_timer();
+    if (!parse_params()) {
+        puts(
+            "Usage: mixer [DUMPBUFFERS] [VERBOSE] [CSV <file>] [BASELINE <file>] [TOLERANCE <percent>] "
+            "[PACKETS <n>] [KERNEL <name>] [GROUP <n>]"
+        );
+        return 20;
+    }
 
-        Sound sound;
-        Sound inverse;
+    ULONG num_packets = param_num(OPT_PACKETS, DEF_PACKETS);
+    ULONG tolerance   = param_num(OPT_TOLERANCE, DEF_TOLERANCE);
+    char const* kernel_name = (char const*)ra_Params[OPT_KERNEL];
+    ULONG group_size  = param_num(OPT_GROUP, 0);
 
-        load_sample("sounds/airstrike.raw", &sound);
+    if (ra_Params[OPT_BASELINE] && !load_baseline((char const*)ra_Params[OPT_BASELINE])) {
+        printf("Could not read baseline %s\n", (char const*)ra_Params[OPT_BASELINE]);
+        free_params();
+        return 20;
+    }
 
-        inverse.s_dataPtr = AllocCacheAligned(sound.s_length, MEMF_FAST);
-        inverse.s_length  = sound.s_length;
-        for (int s = 0; s < sound.s_length; ++s) {
-            inverse.s_dataPtr[s] = - sound.s_dataPtr[s];
-        }
+    FILE* csv = stdout;
+    if (ra_Params[OPT_CSV] && !(csv = fopen((char const*)ra_Params[OPT_CSV], "w"))) {
+        printf("Could not open %s for writing\n", (char const*)ra_Params[OPT_CSV]);
+        free(baseline);
+        free_params();
+        return 20;
+    }
 
-        if (ra_Params[OPT_DUMP_BUFFERS]) {
-            open_dump();
+    if (!(TimerBase = get_timer())) {
+        puts("Could not open timer.device");
+        if (csv != stdout) {
+            fclose(csv);
         }
+        free(baseline);
+        free_params();
+        return 20;
+    }
 
-        for (size_t test = 0; test < sizeof(test_cases)/sizeof(TestCase); ++test) {
+    load_sounds();
 
-            if (Aud_MixPacket_040PreDelta == test_cases[test].mix_function) {
-                EncodeL1D15(&sound);
-                EncodeL1D15(&inverse);
-            }
-
-            printf(
-                "Test case %zu:\n"
-                "\tMix : %s\n"
-                "\tNorm: %s\n"
-                "\tInfo: %s\n\n",
-                test,
-                test_cases[test].mix_info,
-                test_cases[test].norm_info,
-                test_cases[test].extra_info
-            );
+    if (ra_Params[OPT_DUMP_BUFFERS]) {
+        open_dump();
+    }
 
-            for (int max_chan = 1; max_chan <= AUD_NUM_CHANNELS; ++max_chan) {
-                printf("\tMixing %2d channel(s): ", max_chan);
+    fputs(CSV_HEADER, csv);
 
-                for (int chan = 0; chan < max_chan; ++chan) {
-                    mixer->am_ChannelState[chan].ac_SamplePtr   = (
-                        (chan & 1) ? sound.s_dataPtr : inverse.s_dataPtr
-                    ) + (chan << 5);
-                    mixer->am_ChannelState[chan].ac_SamplesLeft = sound.s_length - (chan << 5);
-                    mixer->am_ChannelState[chan].ac_LeftVolume  = chan;
-                    mixer->am_ChannelState[chan].ac_RightVolume = 15 - chan;
-                }
+    ULONG regressions = 0;
+    ULONG unmatched   = 0;
+    ULONG runs        = 0;
 
-                if (ra_Params[OPT_VERBOSE]) {
-                    Aud_DumpMixer(mixer);
+    for (size_t r = 0; r < ARRAY_SIZE(bench_sample_rates); ++r) {
+        for (size_t u = 0; u < ARRAY_SIZE(bench_update_rates); ++u) {
+            for (size_t g = 0; g < ARRAY_SIZE(bench_group_sizes); ++g) {
+                if (group_size && group_size != bench_group_sizes[g]) {
+                    continue;
                 }
 
-                ULONG ticks   = 0;
-                ULONG packets = 0;
-
-                while (mixer->am_ChannelState[0].ac_SamplesLeft > 0) {
-                    time(test_cases[test].mix_function(mixer));
-
-                    ++packets;
-                    ticks += (ULONG)(clk_end.ticks - clk_begin.ticks);
+                for (size_t o = 0; o < ARRAY_SIZE(bench_outputs); ++o) {
+                    OutputConfig const* output = &bench_outputs[o];
+
+                    Aud_Mixer* mixer = Aud_CreateMixer(
+                        bench_sample_rates[r],
+                        bench_update_rates[u],
+                        bench_group_sizes[g],
+                        output->oc_format
+                    );
+                    if (!mixer) {
+                        printf(
+                            "# Could not create %s mixer for %hu Hz / %hu Hz / %hu\n",
+                            output->oc_name,
+                            bench_sample_rates[r],
+                            bench_update_rates[u],
+                            bench_group_sizes[g]
+                        );
+                        SkippedConfig* skipped = &skipped_configs[num_skipped_configs++];
+                        skipped->sc_sampleRateHz = bench_sample_rates[r];
+                        skipped->sc_updateRateHz = bench_update_rates[u];
+                        skipped->sc_groupSize    = bench_group_sizes[g];
+                        skipped->sc_output       = output->oc_name;
+                        continue;
+                    }
+                    if (!Aud_SetStagedOutput(mixer, output->oc_staged)) {
+                        puts("# Could not allocate staging buffer");
+                        Aud_FreeMixer(mixer);
+                        continue;
+                    }
 
-                    if (ra_Params[OPT_DUMP_BUFFERS]) {
-                        dump_mixer(mixer);
+                    for (size_t test = 0; test < NUM_TEST_CASES; ++test) {
+                        TestCase const* test_case = &test_cases[test];
+                        if (kernel_name && 0 != strcmp(kernel_name, test_case->name)) {
+                            continue;
+                        }
+
+                        for (int s = 0; s < num_sounds; ++s) {
+                            for (size_t c = 0; c < ARRAY_SIZE(bench_channel_counts); ++c) {
+                                for (size_t v = 0; v < ARRAY_SIZE(volume_distributions); ++v) {
+                                    BenchResult result = { { 0 }, { 0 }, { 0 }, { 0 } };
+
+                                    run_benchmark(
+                                        mixer,
+                                        test_case,
+                                        output,
+                                        &sounds[s],
+                                        bench_channel_counts[c],
+                                        &volume_distributions[v],
+                                        num_packets,
+                                        &result
+                                    );
+                                    ++runs;
+
+                                    fprintf(
+                                        csv,
+                                        CSV_FORMAT,
+                                        result.br_kernel,
+                                        result.br_sound,
+                                        result.br_sampleRateHz,
+                                        result.br_updateRateHz,
+                                        result.br_groupSize,
+                                        result.br_channels,
+                                        result.br_volumes,
+                                        result.br_output,
+                                        result.br_packets,
+                                        result.br_ticks,
+                                        result.br_usPerPacket,
+                                        result.br_loadPermille
+                                    );
+
+                                    BenchResult const* base = find_baseline(&result);
+                                    if (!base) {
+                                        ++unmatched;
+                                    } else if (
+                                        result.br_usPerPacket * 100 > base->br_usPerPacket * (100 + tolerance)
+                                    ) {
+                                        printf(
+                                            "# REGRESSION %s %s %hu/%hu/%hu %hu ch %s %s: "
+                                            "%lu us/packet, baseline %lu\n",
+                                            result.br_kernel,
+                                            result.br_sound,
+                                            result.br_sampleRateHz,
+                                            result.br_updateRateHz,
+                                            result.br_groupSize,
+                                            result.br_channels,
+                                            result.br_volumes,
+                                            result.br_output,
+                                            result.br_usPerPacket,
+                                            base->br_usPerPacket
+                                        );
+                                        ++regressions;
+                                    }
+                                }
+                            }
+                        }
                     }
+                    Aud_FreeMixer(mixer);
                 }
-                if (ra_Params[OPT_VERBOSE]) {
-                    Aud_DumpMixer(mixer);
-                }
-                printf(" %7lu ticks %lu packets\n", ticks, packets);
             }
+        }
+    }
+
+    run_position_benchmark();
 
+    printf("# %lu runs, %lu regression(s) beyond %lu%%\n", runs, regressions, tolerance);
+
+    if (num_skipped_configs) {
+        printf("# %lu configuration(s) skipped, the mixer could not be created:\n", num_skipped_configs);
+        for (ULONG i = 0; i < num_skipped_configs; ++i) {
+            printf(
+                "#   %s %hu Hz / %hu Hz / %hu\n",
+                skipped_configs[i].sc_output,
+                skipped_configs[i].sc_sampleRateHz,
+                skipped_configs[i].sc_updateRateHz,
+                skipped_configs[i].sc_groupSize
+            );
         }
+    }
 
-        if (ra_Params[OPT_DUMP_BUFFERS]) {
-            close_dump();
+    // A baseline with a different CSV layout or matrix matches nothing, which must not pass as no regressions
+    BOOL baseline_mismatch = FALSE;
+    if (ra_Params[OPT_BASELINE]) {
+        printf("# %lu of %lu runs had no baseline result\n", unmatched, runs);
+        if (unmatched * 2 > runs) {
+            printf(
+                "# BASELINE MISMATCH: most runs have no baseline result in %s, which may be from an older layout\n",
+                (char const*)ra_Params[OPT_BASELINE]
+            );
+            baseline_mismatch = TRUE;
         }
+    }
 
-        FreeCacheAligned(sound.s_dataPtr);
-        FreeCacheAligned(inverse.s_dataPtr);
+    if (ra_Params[OPT_DUMP_BUFFERS]) {
+        close_dump();
+    }
 
-        free_timer();
-        Aud_FreeMixer(mixer);
+    if (csv != stdout) {
+        fclose(csv);
     }
 
-    return 0;
+    free(baseline);
+    free_sounds();
+    free_timer();
+    free_params();
+
+    return (regressions || baseline_mismatch) ? 10 : 0;
 }
@@ -1,7 +1,25 @@
 #include "mixer.h"
+#include "trace.h"
+#include "stream.h"
+#include "position.h"
 #include <stdio.h>
+#ifndef AUD_HOST_BUILD
 #include <proto/exec.h>
 
+/**
+ * Output stage entry points. These use the register conventions of the kernels and are not callable from C.
+ */
+extern void Aud_OutputPaulaHDR(void);
+extern void Aud_Output8Bit(void);
+extern void Aud_OutputPCM16(void);
+
+static void* const output_stages[AUD_NUM_OUTPUT_FORMATS] = {
+    Aud_OutputPaulaHDR,
+    Aud_Output8Bit,
+    Aud_OutputPCM16
+};
+#endif
+
 
 
 /**
@@ -71,7 +89,7 @@ void* AllocCacheAligned(REG(d0, ULONG size), REG(d1, ULONG flags))
  */
 void FreeCacheAligned(REG(a0, void* address))
 {
-    if (!address || CACHE_ALIGN_MASK & ((ULONG)address)) {
+    if (!address || CACHE_ALIGN_MASK & ((size_t)address)) {
         return;
     }
 
@@ -86,6 +104,15 @@ void FreeCacheAligned(REG(a0, void* address))
     FreeVec(byte_address);
 }
 
+/**
+ * Size of the buffer for one side of the output: am_PacketSize samples followed by the volume words. This is
+ * rounded to a whole number of cache lines so that each buffer can be transferred with move16.
+ */
+static size_t PacketBufferSize(Aud_Mixer const* mixer)
+{
+    return CacheAlign(mixer->am_PacketSize + (mixer->am_PacketSize >> 2));
+}
+
 static void ClearAligned(void* address, size_t size)
 {
     ULONG* dst = (ULONG*)address;
@@ -101,18 +128,42 @@ static void ClearAligned(void* address, size_t size)
 
 Aud_Mixer *Aud_CreateMixer(
     REG(d0, UWORD sampleRateHz),
-    REG(d1, UWORD updateRateHz)
+    REG(d1, UWORD updateRateHz),
+    REG(d2, UWORD groupSize),
+    REG(d3, UWORD outputFormat)
 )
 {
     if (
+        outputFormat >= AUD_NUM_OUTPUT_FORMATS ||
         sampleRateHz < MIN_SAMPLE_RATE ||
         sampleRateHz > MAX_SAMPLE_RATE ||
         updateRateHz < MIN_UPDATE_RATE ||
-        updateRateHz > MAX_UPDATE_RATE
+        updateRateHz > MAX_UPDATE_RATE ||
+        groupSize < AUD_MIN_GROUP_SIZE ||
+        groupSize > AUD_MAX_GROUP_SIZE ||
+        (groupSize & (groupSize - 1))
     ) {
         return NULL;
     }
 
+    // Packets are a whole number of lines, with a short final group where that is not a whole number of groups.
+    // Paula plays the volume words of Paula HDR output at a fixed rate of one per group, so there the packet must be
+    // a whole number of groups. Don't allow that rounding to add more than a line of samples per update, as the
+    // mixer would otherwise run noticeably faster than the requested update rate.
+    UWORD samples_per_update = sampleRateHz / updateRateHz;
+    UWORD packet_size        = (samples_per_update + CACHE_LINE_SIZE - 1) & ~CACHE_ALIGN_MASK;
+    if (AUD_OUTPUT_PAULA_HDR == outputFormat) {
+        packet_size = (samples_per_update + groupSize - 1) & ~(groupSize - 1);
+        if (packet_size - samples_per_update > CACHE_LINE_SIZE) {
+            return NULL;
+        }
+    }
+
+    UWORD group_shift = 0;
+    while ((1 << group_shift) < groupSize) {
+        ++group_shift;
+    }
+
     size_t context_size = CacheAlign(sizeof(Aud_Mixer));
 
     size_t tables_size  = (AUD_8_TO_16_LEVELS - 1) * 256 * sizeof(WORD);
@@ -124,35 +175,77 @@ Aud_Mixer *Aud_CreateMixer(
         mixer->am_LeftPacketSamplePtr = NULL;
         mixer->am_SampleRateHz = sampleRateHz;
         mixer->am_UpdateRateHz = updateRateHz;
-        mixer->am_PacketSize   = (UWORD)CacheAlign(sampleRateHz / updateRateHz);
+        mixer->am_PacketSize   = packet_size;
         mixer->am_TableOffset  = context_size;
-
-        // Allocate a single chip ram block that is big enough to hold all the bits
-        size_t chip_size = mixer->am_PacketSize + (mixer->am_PacketSize >> 2);
-
-        mixer->am_ChipBufferPtr = (UBYTE*)AllocCacheAligned(chip_size << 1, MEMF_CHIP); // MEMF_CHIP
-
-        if (!mixer->am_ChipBufferPtr) {
-            Aud_FreeMixer(mixer);
-            return NULL;
+        mixer->am_GroupSize    = groupSize;
+        mixer->am_GroupShift   = group_shift;
+        mixer->am_GroupEnd     = (packet_size < groupSize ? packet_size : groupSize) << 1;
+        mixer->am_GroupLength  = groupSize;
+        mixer->am_PacketSamplesLeft = packet_size;
+        mixer->am_OutputFormat = outputFormat;
+#ifndef AUD_HOST_BUILD
+        mixer->am_OutputStagePtr = output_stages[outputFormat];
+#endif
+
+        if (AUD_OUTPUT_PCM16 == outputFormat) {
+            // Interleaved frames of two words, nothing is written to Chip RAM
+            mixer->am_PCMBufferPtr = (WORD*)AllocCacheAligned(mixer->am_PacketSize << 2, MEMF_FAST);
+            if (!mixer->am_PCMBufferPtr) {
+                Aud_FreeMixer(mixer);
+                return NULL;
+            }
+        } else {
+            // Allocate a single chip ram block that is big enough to hold all the bits
+            size_t chip_size = PacketBufferSize(mixer);
+
+            mixer->am_ChipBufferPtr = (UBYTE*)AllocCacheAligned(chip_size << 1, MEMF_CHIP); // MEMF_CHIP
+
+            if (!mixer->am_ChipBufferPtr) {
+                Aud_FreeMixer(mixer);
+                return NULL;
+            }
         }
         Aud_ResetBuffers(mixer);
         Aud_SetMixerVolume(mixer, 8192);
+        Aud_SetMasterGain(mixer, AUD_UNITY_GAIN, 0);
     }
     return mixer;
 }
 
 void Aud_FreeMixer(REG(a0, Aud_Mixer* mixer))
 {
+    if (mixer && mixer->am_TracePtr) {
+        Aud_CloseTrace(mixer);
+    }
+    if (mixer && mixer->am_StreamPtr) {
+        Aud_CloseStream(mixer);
+    }
+    if (mixer && mixer->am_PositionModelPtr) {
+        Aud_FreePositionModel(mixer);
+    }
     if (mixer && mixer->am_LeftPacketSamplePtr) {
         FreeCacheAligned(mixer->am_ChipBufferPtr);
     }
+    if (mixer) {
+        FreeCacheAligned(mixer->am_StagingBufferPtr);
+        FreeCacheAligned(mixer->am_PCMBufferPtr);
+    }
     FreeCacheAligned(mixer);
 }
 
 void Aud_ResetBuffers(REG(a0, Aud_Mixer* mixer))
 {
-    size_t chip_size = mixer->am_PacketSize + (mixer->am_PacketSize >> 2);
+    if (AUD_OUTPUT_PCM16 == mixer->am_OutputFormat) {
+        // The interleaved frames are written via the left sample pointers only
+        BYTE* output = (BYTE*)(mixer->am_OutputBufferPtr ? mixer->am_OutputBufferPtr : mixer->am_PCMBufferPtr);
+
+        mixer->am_LeftPacketSamplePtr          =
+        mixer->am_LeftPacketSampleBasePtr      =
+        mixer->am_LeftPacketSampleWriteBasePtr = output;
+        return;
+    }
+
+    size_t chip_size = PacketBufferSize(mixer);
     mixer->am_LeftPacketSamplePtr =
     mixer->am_LeftPacketSampleBasePtr = (BYTE*)mixer->am_ChipBufferPtr;
 
@@ -164,26 +257,64 @@ void Aud_ResetBuffers(REG(a0, Aud_Mixer* mixer))
 
     mixer->am_RightPacketVolumePtr =
     mixer->am_RightPacketVolumeBasePtr = (UWORD*)(mixer->am_ChipBufferPtr + chip_size + mixer->am_PacketSize);
+
+    // The staging buffer has the same layout as the Chip RAM one
+    UBYTE* write_base = (mixer->am_UseStagedOutput && mixer->am_StagingBufferPtr) ?
+        mixer->am_StagingBufferPtr :
+        mixer->am_ChipBufferPtr;
+
+    mixer->am_LeftPacketSampleWriteBasePtr  = (BYTE*)write_base;
+    mixer->am_LeftPacketVolumeWriteBasePtr  = (UWORD*)(write_base + mixer->am_PacketSize);
+    mixer->am_RightPacketSampleWriteBasePtr = (BYTE*)(write_base + chip_size);
+    mixer->am_RightPacketVolumeWriteBasePtr = (UWORD*)(write_base + chip_size + mixer->am_PacketSize);
 }
 
+BOOL Aud_SetStagedOutput(
+    REG(a0, Aud_Mixer* mixer),
+    REG(d0, BOOL enable)
+)
+{
+    if (AUD_OUTPUT_PCM16 == mixer->am_OutputFormat) {
+        return !enable;
+    }
+    if (enable && !mixer->am_StagingBufferPtr) {
+        mixer->am_StagingBufferPtr = (UBYTE*)AllocCacheAligned(PacketBufferSize(mixer) << 1, MEMF_FAST);
+        if (!mixer->am_StagingBufferPtr) {
+            return FALSE;
+        }
+    }
+    mixer->am_UseStagedOutput = enable ? 1 : 0;
+    Aud_ResetBuffers(mixer);
+    return TRUE;
+}
 
-void Aud_SetMixerVolume(
+BOOL Aud_SetOutputBuffer(
     REG(a0, Aud_Mixer* mixer),
-    REG(d0, UWORD volume)
+    REG(a1, WORD* buffer)
 )
 {
+    if (AUD_OUTPUT_PCM16 != mixer->am_OutputFormat) {
+        return FALSE;
+    }
+    mixer->am_OutputBufferPtr = buffer;
+    Aud_ResetBuffers(mixer);
+    return TRUE;
+}
 
-    /**
-     * Generate AUD_8_TO_16_LEVELS-1 tables of 256 words each, intended to be indexed by the (unsigned) sample
-     * position to obtain the desired 16-bit value.
-     */
+/**
+ * Generate AUD_8_TO_16_LEVELS-1 tables of 256 words each, intended to be indexed by the (unsigned) sample
+ * position to obtain the desired 16-bit value.
+ */
+static void GenerateTables(Aud_Mixer* mixer, UWORD volume)
+{
     WORD* table_ptr  = (WORD*)((UBYTE*)mixer + mixer->am_TableOffset);
     WORD  table_step = (WORD)(volume / AUD_8_TO_16_LEVELS);
     WORD  table_max  = table_step;
 
+    mixer->am_TableVolume    = volume;
     mixer->am_VolumeScale[0] = 0;
     for (int t = 0; t < (AUD_8_TO_16_LEVELS - 1); ++t) {
-        WORD  level_step    = table_max / 128;
+        WORD  level_step    = table_max >> 7;
         WORD  level         = level_step;
 
         mixer->am_VolumeScale[t+1] = level;
@@ -199,9 +330,242 @@ void Aud_SetMixerVolume(
         table_ptr += 256;
         table_max += table_step;
     }
+}
+
+/**
+ * Table volume for the given number of gain control steps below the mixer volume
+ */
+static UWORD GainControlVolume(UWORD volume, UWORD step)
+{
+    while (step--) {
+        volume -= volume >> 2;
+    }
+    return volume;
+}
+
+void Aud_SetMixerVolume(
+    REG(a0, Aud_Mixer* mixer),
+    REG(d0, UWORD volume)
+)
+{
+    mixer->am_MixerVolume   = volume;
+    mixer->am_GainHoldCount = 0;
+
+    volume = GainControlVolume(volume, mixer->am_GainControlStep);
+    if (volume != mixer->am_TableVolume) {
+        GenerateTables(mixer, volume);
+    }
+}
+
+static void RampMasterGain(Aud_Mixer* mixer, UWORD gain, UWORD packets)
+{
+    if (!packets) {
+        mixer->am_MasterGain       = gain;
+        mixer->am_MasterGainTarget = gain;
+        mixer->am_MasterGainStep   = 0;
+        return;
+    }
+
+    // The gain is stepped once per group
+    LONG delta = (LONG)gain - (LONG)mixer->am_MasterGain;
+    LONG steps = (LONG)packets * ((mixer->am_PacketSize + mixer->am_GroupSize - 1) >> mixer->am_GroupShift);
+    // Round the step away from zero so that the ramp always completes in time
+    LONG step  = delta < 0 ? (delta - steps + 1) / steps : (delta + steps - 1) / steps;
+    if (!step) {
+        step = 1;
+    }
+    mixer->am_MasterGainStep   = (WORD)step;
+    mixer->am_MasterGainTarget = gain;
+}
+
+void Aud_SetMasterGain(
+    REG(a0, Aud_Mixer* mixer),
+    REG(d0, UWORD gain),
+    REG(d1, UWORD packets)
+)
+{
+    if (gain > AUD_UNITY_GAIN) {
+        gain = AUD_UNITY_GAIN;
+    }
+    RampMasterGain(mixer, gain, packets);
+}
+
+/**
+ * Worst case accumulated peak for the active channels at the current table volume, as the sum of the largest
+ * magnitude each one can contribute to either side.
+ */
+static ULONG PredictPeak(Aud_Mixer const* mixer)
+{
+    ULONG left  = 0;
+    ULONG right = 0;
+    for (int channel = 0; channel < AUD_NUM_CHANNELS; ++channel) {
+        Aud_ChannelState const* state = &mixer->am_ChannelState[channel];
+        if (!state->ac_SamplePtr || !state->ac_SamplesLeft) {
+            continue;
+        }
+        // The -128 table entry can exceed the scale * 128 by up to 127
+        UWORD left_volume  = state->ac_LeftVolume  & 0x0F;
+        UWORD right_volume = state->ac_RightVolume & 0x0F;
+        if (left_volume) {
+            left  += ((ULONG)mixer->am_VolumeScale[left_volume]  + 1) << 7;
+        }
+        if (right_volume) {
+            right += ((ULONG)mixer->am_VolumeScale[right_volume] + 1) << 7;
+        }
+    }
+    return left > right ? left : right;
+}
+
+/**
+ * Moves the table volume to the given gain control step. The master gain is scaled by the inverse of the change and
+ * then ramped back to its target. The scaled gain is limited to AUD_GC_MAX_GAIN, so a drop of more than about two
+ * steps at once is not fully hidden and the output level falls by the remainder.
+ */
+static void SetGainControlStep(Aud_Mixer* mixer, UWORD step)
+{
+    UWORD old_volume = mixer->am_TableVolume;
+    UWORD new_volume = GainControlVolume(mixer->am_MixerVolume, step);
+
+    mixer->am_GainControlStep = step;
+    if (new_volume == old_volume || !new_volume) {
+        return;
+    }
+    GenerateTables(mixer, new_volume);
+
+    ULONG gain = ((ULONG)mixer->am_MasterGain * old_volume) / new_volume;
+    mixer->am_MasterGain = (UWORD)(gain > AUD_GC_MAX_GAIN ? AUD_GC_MAX_GAIN : gain);
+    RampMasterGain(mixer, mixer->am_MasterGainTarget, AUD_GC_RAMP_PACKETS);
+}
 
+BOOL Aud_EnableGainControl(
+    REG(a0, Aud_Mixer* mixer),
+    REG(d0, BOOL enable)
+)
+{
+    if (AUD_OUTPUT_PAULA_HDR != mixer->am_OutputFormat) {
+        return !enable;
+    }
+    mixer->am_UseGainControl = enable ? 1 : 0;
+    mixer->am_GainHoldCount  = 0;
+
+    // Restore the full volume if we are turning it off
+    if (!enable && mixer->am_GainControlStep) {
+        SetGainControlStep(mixer, 0);
+    }
+    return TRUE;
 }
 
+void Aud_UpdateGainControl(
+    REG(a0, Aud_Mixer* mixer)
+)
+{
+    if (!mixer->am_UseGainControl) {
+        return;
+    }
+
+    ULONG peak = PredictPeak(mixer);
+    UWORD step = mixer->am_GainControlStep;
+
+    if (peak > AUD_GC_LIMIT_LEVEL) {
+        // The accumulators could overflow in this packet, so step down immediately. Estimate the number of steps
+        // needed so that the tables are normally only generated once, then confirm against the new tables.
+        mixer->am_GainHoldCount = 0;
+        while (peak > AUD_GC_LIMIT_LEVEL && step < AUD_GC_MAX_STEPS) {
+            peak -= peak >> 2;
+            ++step;
+        }
+        SetGainControlStep(mixer, step);
+        while (step < AUD_GC_MAX_STEPS && PredictPeak(mixer) > AUD_GC_LIMIT_LEVEL) {
+            SetGainControlStep(mixer, ++step);
+        }
+    } else if (step && peak + (peak >> 1) < AUD_GC_RELEASE_LEVEL) {
+        // Enough headroom for a step up, with some to spare, once it has been sustained
+        if (++mixer->am_GainHoldCount >= AUD_GC_HOLD_PACKETS) {
+            mixer->am_GainHoldCount = 0;
+            SetGainControlStep(mixer, step - 1);
+        }
+    } else {
+        mixer->am_GainHoldCount = 0;
+    }
+}
+
+void Aud_StartChannel(
+    REG(a0, Aud_Mixer* mixer),
+    REG(a1, BYTE* samplePtr),
+    REG(d0, UWORD channel),
+    REG(d1, UWORD length),
+    REG(d2, UWORD leftVolume),
+    REG(d3, UWORD rightVolume)
+)
+{
+    if (channel >= AUD_NUM_CHANNELS || Aud_IsStreamChannel(mixer, channel)) {
+        return;
+    }
+    Aud_ChannelState* state = &mixer->am_ChannelState[channel];
+
+    // Kernels consume whole lines, so the length must be a multiple of CACHE_LINE_SIZE
+    state->ac_SamplePtr   = samplePtr;
+    state->ac_SamplesLeft = length & ~CACHE_ALIGN_MASK;
+    state->ac_LeftVolume  = (UBYTE)leftVolume;
+    state->ac_RightVolume = (UBYTE)rightVolume;
+
+    if (mixer->am_TracePtr) {
+        Aud_TraceStart(
+            mixer->am_TracePtr,
+            mixer->am_PacketCount,
+            channel,
+            samplePtr,
+            state->ac_SamplesLeft,
+            leftVolume,
+            rightVolume
+        );
+    }
+}
+
+void Aud_StopChannel(
+    REG(a0, Aud_Mixer* mixer),
+    REG(d0, UWORD channel)
+)
+{
+    if (channel >= AUD_NUM_CHANNELS || Aud_IsStreamChannel(mixer, channel)) {
+        return;
+    }
+    Aud_ChannelState* state = &mixer->am_ChannelState[channel];
+    state->ac_SamplePtr   = NULL;
+    state->ac_SamplesLeft = 0;
+    state->ac_LeftVolume  = 0;
+    state->ac_RightVolume = 0;
+
+    if (mixer->am_TracePtr) {
+        Aud_TraceStop(mixer->am_TracePtr, mixer->am_PacketCount, channel);
+    }
+}
+
+void Aud_SetChannelVolume(
+    REG(a0, Aud_Mixer* mixer),
+    REG(d0, UWORD channel),
+    REG(d1, UWORD leftVolume),
+    REG(d2, UWORD rightVolume)
+)
+{
+    if (channel >= AUD_NUM_CHANNELS || Aud_IsStreamChannel(mixer, channel)) {
+        return;
+    }
+    Aud_ChannelState* state = &mixer->am_ChannelState[channel];
+    state->ac_LeftVolume  = (UBYTE)leftVolume;
+    state->ac_RightVolume = (UBYTE)rightVolume;
+
+    if (mixer->am_TracePtr) {
+        Aud_TraceVolume(mixer->am_TracePtr, mixer->am_PacketCount, channel, leftVolume, rightVolume);
+    }
+}
+
+static char const* const output_format_names[AUD_NUM_OUTPUT_FORMATS] = {
+    "Paula HDR",
+    "8-bit",
+    "16-bit PCM"
+};
+
 extern void Aud_DumpMixer(
     REG(a0, Aud_Mixer* mixer)
 )
@@ -210,27 +574,37 @@ extern void Aud_DumpMixer(
         "Aud_Mixer allocated at %p\n"
         "\tMix Rate      %hu Hz\n"
         "\tUpdate Rate   %hu Hz\n"
-        "\tPacket Length %hu samples [%hu lines]\n"
+        "\tPacket Length %hu samples [%hu lines, %hu groups of %hu]\n"
         "\tLeft Sample Packet at  %p\n"
         "\tLeft Volume Packet at  %p\n"
         "\tRight Sample Packet at %p\n"
         "\tRight Volume Packet at %p\n"
+        "\tStaging Buffer at %p [%s]\n"
+        "\tOutput Format %s\n"
         "\tVolume Tables at %p\n"
         "\tAbsMaxL %hu [Norm Index %hu]\n"
         "\tAbsMaxR %hu [Norm Index %hu]\n"
         "\tMultiplication Mixing        %s\n"
         "\tMultiplication Normalisation %s\n"
         "\tNorm Table at %p\n"
+        "\tPackets Mixed %lu\n"
+        "\tMaster Gain   %hu [Target %hu, Step %hd]\n"
+        "\tTable Volume  %hu [Mixer Volume %hu, Gain Control %s]\n"
         "",
         mixer,
         mixer->am_SampleRateHz,
         mixer->am_UpdateRateHz,
         mixer->am_PacketSize,
         mixer->am_PacketSize / CACHE_LINE_SIZE,
+        (mixer->am_PacketSize + mixer->am_GroupSize - 1) >> mixer->am_GroupShift,
+        mixer->am_GroupSize,
         mixer->am_LeftPacketSamplePtr,
         mixer->am_LeftPacketVolumePtr,
         mixer->am_RightPacketSamplePtr,
         mixer->am_RightPacketVolumePtr,
+        mixer->am_StagingBufferPtr,
+        mixer->am_UseStagedOutput ? "Enabled" : "Disabled",
+        output_format_names[mixer->am_OutputFormat],
         ((UBYTE*)mixer) + mixer->am_TableOffset,
         mixer->am_AbsMaxL,
         mixer->am_IndexL,
@@ -238,7 +612,14 @@ extern void Aud_DumpMixer(
         mixer->am_IndexR,
         mixer->am_UseMultiplyMixing ? "Enabled" : "Disabled",
         mixer->am_UseMultiplyNormalisation ? "Enabled" : "Disabled",
-        Aud_NormFactors_vw
+        Aud_NormFactors_vw,
+        (unsigned long)mixer->am_PacketCount,
+        mixer->am_MasterGain,
+        mixer->am_MasterGainTarget,
+        mixer->am_MasterGainStep,
+        mixer->am_TableVolume,
+        mixer->am_MixerVolume,
+        mixer->am_UseGainControl ? "Enabled" : "Disabled"
     );
 
     for (int channel = 0; channel < AUD_NUM_CHANNELS; ++channel) {
@@ -261,13 +642,13 @@ extern void Aud_DumpMixer(
     puts("]");
 
     printf("Left Mix Buffer  [");
-    for (int i = 0; i < CACHE_LINE_SIZE; ++i) {
+    for (int i = 0; i < mixer->am_GroupSize; ++i) {
         printf("%+5d, ", (int)mixer->am_AccumL[i]);
     }
     puts("]");
 
     printf("Right Mix Buffer [");
-    for (int i = 0; i < CACHE_LINE_SIZE; ++i) {
+    for (int i = 0; i < mixer->am_GroupSize; ++i) {
         printf("%+5d, ", (int)mixer->am_AccumR[i]);
     }
     puts("]");
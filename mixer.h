@@ -1,8 +1,12 @@
 #ifndef _TKG_MIXER_H_
 #define _TKG_MIXER_H_
 
+#ifdef AUD_HOST_BUILD
+#include "host.h"
+#else
 #include <SDI_compiler.h>
 #include <exec/types.h>
+#endif
 
 // CPU cache line size
 #define CACHE_LINE_SIZE 16
@@ -13,6 +17,42 @@
 
 #define AUD_NUM_CHANNELS 16
 
+// Normalisation group sizes. Peak analysis and normalisation are performed per group of this many samples, each
+// of which gets one volume word. Must be a power of 2 multiple of CACHE_LINE_SIZE.
+#define AUD_MIN_GROUP_SIZE     CACHE_LINE_SIZE
+#define AUD_MAX_GROUP_SIZE     64
+#define AUD_DEFAULT_GROUP_SIZE AUD_MIN_GROUP_SIZE
+
+// Output formats, selected when the mixer is created
+#define AUD_OUTPUT_PAULA_HDR 0 // 8-bit normalised sample data plus a volume word per group, for Paula
+#define AUD_OUTPUT_8BIT      1 // 8-bit sample data at full scale only, for playback at a fixed volume
+#define AUD_OUTPUT_PCM16     2 // Interleaved 16-bit linear PCM in Fast RAM, for AHI, Emu68 or host rendering
+#define AUD_NUM_OUTPUT_FORMATS 3
+
+// Volume index that 8-bit data are normalised for by AUD_OUTPUT_8BIT, i.e. AUDxVOL 64
+#define AUD_FULL_SCALE_INDEX 63
+
+// Master gain value that leaves the mix unchanged
+#define AUD_UNITY_GAIN 256
+
+// Largest peak * gain, before the >> 8, that gives a 15-bit scaled peak
+#define AUD_MAX_SCALED_PEAK 0x7FFFFF
+
+// Gain control. The worst case accumulated peak of the active channels is predicted before each packet. When it
+// exceeds AUD_GC_LIMIT_LEVEL, the volume the tables are generated for is lowered by as many steps of 1/4 as
+// needed, up to AUD_GC_MAX_STEPS. Once the prediction for one step up has stayed below AUD_GC_RELEASE_LEVEL for
+// AUD_GC_HOLD_PACKETS, it is raised again by one step. Each step is compensated for by the master gain, which is
+// then ramped back to its target over AUD_GC_RAMP_PACKETS. The compensating gain is limited to AUD_GC_MAX_GAIN,
+// about 2x, which keeps the scaled normalisation factors within 16 bits. That hides a drop of up to 2 steps from
+// unity gain. Any larger drop in a single packet, e.g. when many loud channels start together, lowers the output
+// level at once by the part the gain cannot cover.
+#define AUD_GC_LIMIT_LEVEL   32000
+#define AUD_GC_RELEASE_LEVEL 24576
+#define AUD_GC_HOLD_PACKETS  25
+#define AUD_GC_MAX_STEPS     8
+#define AUD_GC_RAMP_PACKETS  4
+#define AUD_GC_MAX_GAIN      511
+
 #define MIN_SAMPLE_RATE 8000
 #define MAX_SAMPLE_RATE 22050
 #define MIN_UPDATE_RATE 10
@@ -25,21 +65,26 @@ typedef struct {
     UBYTE   ac_RightVolume;
 } Aud_ChannelState;
 
+struct Aud_Trace;
+struct Aud_Stream;
+struct Aud_PositionModel;
+
 typedef struct {
     Aud_ChannelState am_ChannelState[AUD_NUM_CHANNELS];
 
     // The am_FetchBuffer contains the set of 8-bit samples just fetched for the current channel
     BYTE am_FetchBuffer[CACHE_LINE_SIZE];
 
-    // The am_AccumL/am_AccumR buffers contain the current 16-bit mixed data
-    WORD am_AccumL[CACHE_LINE_SIZE];
-    WORD am_AccumR[CACHE_LINE_SIZE];
+    // The am_AccumL/am_AccumR buffers contain the current group of 16-bit mixed data. Each line is mixed at its
+    // offset in the group and the whole group is normalised once the last line has been mixed.
+    WORD am_AccumL[AUD_MAX_GROUP_SIZE];
+    WORD am_AccumR[AUD_MAX_GROUP_SIZE];
 
     // Chip RAM Buffer Pointers (working)
     BYTE*  am_LeftPacketSamplePtr;  // contains am_PacketSize normalised 8-bit sample data for the left channel
-    UWORD* am_LeftPacketVolumePtr;  // contains am_PacketSize/16 6-bit volume modulation data for the left channel
+    UWORD* am_LeftPacketVolumePtr;  // contains am_PacketSize/group 6-bit volume modulation data for the left channel
     BYTE*  am_RightPacketSamplePtr; // contains am_PacketSize normalised 8-bit sample data for the right channel
-    UWORD* am_RightPacketVolumePtr; // contains am_PacketSize/16 6-bit volume modulation data for the right channel
+    UWORD* am_RightPacketVolumePtr; // contains am_PacketSize/group 6-bit volume modulation data for the right channel
 
     // Counters
     UWORD  am_AbsMaxL;
@@ -53,9 +98,9 @@ typedef struct {
 
     // Config
     BYTE*  am_LeftPacketSampleBasePtr;  // contains am_PacketSize normalised 8-bit sample data for the left channel
-    UWORD* am_LeftPacketVolumeBasePtr;  // contains am_PacketSize/16 6-bit volume modulation data for the left channel
+    UWORD* am_LeftPacketVolumeBasePtr;  // contains am_PacketSize/group 6-bit volume modulation data for the left channel
     BYTE*  am_RightPacketSampleBasePtr; // contains am_PacketSize normalised 8-bit sample data for the right channel
-    UWORD* am_RightPacketVolumeBasePtr; // contains am_PacketSize/16 6-bit volume modulation data for the right
+    UWORD* am_RightPacketVolumeBasePtr; // contains am_PacketSize/group 6-bit volume modulation data for the right
 
     UBYTE* am_ChipBufferPtr;
 
@@ -65,26 +110,159 @@ typedef struct {
     UWORD  am_TableOffset;
     UBYTE  am_UseMultiplyMixing;
     UBYTE  am_UseMultiplyNormalisation;
+
+    // Number of packets mixed so far. Incremented by every Aud_MixPacket_* kernel.
+    ULONG  am_PacketCount;
+
+    // Sound event trace being recorded, or NULL
+    struct Aud_Trace* am_TracePtr;
+
+    // Master gain, applied by the output stage. Ramped towards the target by the step once per group.
+    UWORD  am_MasterGain;
+    UWORD  am_MasterGainTarget;
+    WORD   am_MasterGainStep;
+
+    // Number of steps the gain control has lowered the table volume by
+    UWORD  am_GainControlStep;
+
+    // Gain control state
+    UWORD  am_MixerVolume;  // volume set by Aud_SetMixerVolume()
+    UWORD  am_TableVolume;  // volume the tables were last generated for
+    UWORD  am_GainHoldCount;
+    UBYTE  am_UseGainControl;
+    UBYTE  am_UseStagedOutput;
+
+    // Write base pointers. When writing directly, these are the Chip RAM base pointers. For staged output they
+    // are the equivalent locations in the Fast RAM staging buffer, which is transferred to Chip RAM with move16
+    // at the end of each packet.
+    BYTE*  am_LeftPacketSampleWriteBasePtr;
+    UWORD* am_LeftPacketVolumeWriteBasePtr;
+    BYTE*  am_RightPacketSampleWriteBasePtr;
+    UWORD* am_RightPacketVolumeWriteBasePtr;
+
+    UBYTE* am_StagingBufferPtr;
+
+    // Normalisation group size in samples, and log2 of it
+    UWORD  am_GroupSize;
+    UWORD  am_GroupShift;
+
+    // Group progress. The final group of a packet is short when the packet is not a whole number of groups.
+    UWORD  am_GroupEnd;          // byte offset in the accumulation buffers at which the group being mixed is complete
+    UWORD  am_GroupLength;       // samples in the group being output
+    UWORD  am_PacketSamplesLeft; // samples of the packet from the start of the group being mixed
+
+    // Music stream playing on a reserved channel, or NULL
+    struct Aud_Stream* am_StreamPtr;
+
+    // Output stage entry point, entered once per group by the kernels. Not set for host builds.
+    void*  am_OutputStagePtr;
+
+    // AUD_OUTPUT_PCM16 destination, am_PacketSize interleaved left/right frames. The mixer allocates its own
+    // buffer, which is used until the caller supplies one with Aud_SetOutputBuffer().
+    WORD*  am_OutputBufferPtr;
+    WORD*  am_PCMBufferPtr;
+
+    UWORD  am_OutputFormat;
+
+    // Positional audio tables, or NULL
+    struct Aud_PositionModel* am_PositionModelPtr;
 } Aud_Mixer;
 
+/**
+ * Creates a mixer for the given sample and update rates. The group size, AUD_MIN_GROUP_SIZE - AUD_MAX_GROUP_SIZE,
+ * sets how many samples share each volume word. Larger groups reduce the analysis work and Chip RAM writes at the
+ * expense of dynamic resolution. The packet size is rounded up to a whole number of lines, and the final group of a
+ * packet is short where that is not a whole number of groups. For AUD_OUTPUT_PAULA_HDR, whose volume words Paula
+ * plays at a fixed rate of one per group, the packet is instead rounded up to a whole number of groups, and NULL is
+ * returned where that would add more than CACHE_LINE_SIZE samples, e.g. 8000 Hz at 100 Hz in groups of 64.
+ *
+ * The output format selects the stage each group is written out by. Only AUD_OUTPUT_PAULA_HDR performs the peak
+ * analysis and normalisation. AUD_OUTPUT_8BIT writes the same Chip RAM sample buffers without volume data, and
+ * AUD_OUTPUT_PCM16 skips the Chip RAM buffers entirely, writing the accumulated data as they are.
+ */
 extern Aud_Mixer *Aud_CreateMixer(
     REG(d0, UWORD sampleRateHz),
-    REG(d1, UWORD updateRateHz)
+    REG(d1, UWORD updateRateHz),
+    REG(d2, UWORD groupSize),
+    REG(d3, UWORD outputFormat)
 );
 
 extern void Aud_FreeMixer(
     REG(a0, Aud_Mixer* mixer)
 );
 
+/**
+ * Sets the base volume the 8 to 16 bit conversion tables are generated for. This is relatively expensive and
+ * should not be used for fades. The tables are only regenerated when the volume actually changes.
+ */
 extern void Aud_SetMixerVolume(
     REG(a0, Aud_Mixer* mixer),
     REG(d0, UWORD volume)
 );
 
+/**
+ * Sets the master gain, 0 - AUD_UNITY_GAIN, which is applied by the output stage at negligible cost. The gain
+ * is ramped linearly to the new value over the given number of packets, or set immediately for 0.
+ */
+extern void Aud_SetMasterGain(
+    REG(a0, Aud_Mixer* mixer),
+    REG(d0, UWORD gain),
+    REG(d1, UWORD packets)
+);
+
+/**
+ * Enables or disables the automatic gain control, which lowers the table volume in coarse steps whenever the
+ * active channels could overflow the accumulators and restores it once there is headroom again. The tables are
+ * only regenerated on a step, which the master gain hides. Aud_UpdateGainControl() should be called once before
+ * each packet is mixed, after the channel changes for it have been made. Returns FALSE when enabling for any format
+ * other than AUD_OUTPUT_PAULA_HDR, as only its output stage limits the compensating gain above unity.
+ */
+extern BOOL Aud_EnableGainControl(
+    REG(a0, Aud_Mixer* mixer),
+    REG(d0, BOOL enable)
+);
+
+extern void Aud_UpdateGainControl(
+    REG(a0, Aud_Mixer* mixer)
+);
+
+/**
+ * Channel control. These should be used in preference to writing to am_ChannelState directly so that the
+ * events can be recorded when a trace is attached to the mixer. A channel reserved by a music stream is ignored.
+ */
+extern void Aud_StartChannel(
+    REG(a0, Aud_Mixer* mixer),
+    REG(a1, BYTE* samplePtr),
+    REG(d0, UWORD channel),
+    REG(d1, UWORD length),
+    REG(d2, UWORD leftVolume),
+    REG(d3, UWORD rightVolume)
+);
+
+extern void Aud_StopChannel(
+    REG(a0, Aud_Mixer* mixer),
+    REG(d0, UWORD channel)
+);
+
+extern void Aud_SetChannelVolume(
+    REG(a0, Aud_Mixer* mixer),
+    REG(d0, UWORD channel),
+    REG(d1, UWORD leftVolume),
+    REG(d2, UWORD rightVolume)
+);
+
 extern void Aud_MixPacket(
     REG(a0, Aud_Mixer* mixer)
 );
 
+/**
+ * Portable C implementation. Produces the same output as Aud_MixPacket_060 and is the only kernel available
+ * in host builds.
+ */
+extern void Aud_MixPacket_C(
+    REG(a0, Aud_Mixer* mixer)
+);
+
 extern void Aud_MixPacket_060(
     REG(a0, Aud_Mixer* mixer)
 );
@@ -110,6 +288,26 @@ extern void Aud_MixPacket_040Shifted(
     REG(a0, Aud_Mixer* mixer)
 );
 
+/**
+ * Enables or disables staged output. When enabled, normalised sample and volume data are written to a cache
+ * aligned Fast RAM staging area, which is transferred to the Chip RAM buffers in cache line bursts at the end
+ * of each packet. The staging area is allocated on first use. Returns FALSE if it could not be allocated, or when
+ * enabling for AUD_OUTPUT_PCM16, which already writes to Fast RAM.
+ */
+extern BOOL Aud_SetStagedOutput(
+    REG(a0, Aud_Mixer* mixer),
+    REG(d0, BOOL enable)
+);
+
+/**
+ * Sets the destination for AUD_OUTPUT_PCM16, which must hold am_PacketSize interleaved left/right WORD frames
+ * and should be in Fast RAM. NULL restores the mixer's own buffer. Returns FALSE for the other formats.
+ */
+extern BOOL Aud_SetOutputBuffer(
+    REG(a0, Aud_Mixer* mixer),
+    REG(a1, WORD* buffer)
+);
+
 extern void Aud_DumpMixer(
     REG(a0, Aud_Mixer* mixer)
 );
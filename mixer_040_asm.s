@@ -11,7 +11,8 @@
         xdef _Aud_MixPacket_040Linear
         xdef _Aud_MixPacket_040Shifted
 
-        xref _Aud_NormFactors_vw;
+        xref Aud_OutputLine
+        xref Aud_FlushStagedOutput
 
         include "68040/null.s"
         include "68040/linear.s"
@@ -12,6 +12,18 @@ AUD_8_TO_16_LEVELS  EQU 16
 ; Number of channels
 AUD_NUM_CHANNELS    EQU 16
 
+; Largest normalisation group size, in samples
+AUD_MAX_GROUP_SIZE  EQU 64
+
+; Volume index that 8-bit data are normalised for by the plain 8-bit output stage
+AUD_FULL_SCALE_INDEX EQU 63
+
+; Master gain value that leaves the mix unchanged
+AUD_UNITY_GAIN      EQU 256
+
+; Largest peak * gain, before the >> 8, that gives a 15-bit scaled peak
+AUD_MAX_SCALED_PEAK EQU $7FFFFF
+
     STRUCTURE Aud_ChanelState,0
         APTR  ac_SamplePtr_l ; 4 Current address of the data
         WORD  ac_SamplesLeft_w  ; 2 Remaining number of bytes
@@ -28,13 +40,12 @@ AUD_NUM_CHANNELS    EQU 16
         ; Contains the next cache line worth of incoming 8-bit sample data
         BYTE_ARRAY am_FetchBuffer_vb,CACHE_LINE_SIZE
 
-        ; Contains the current cache line pair of the accumulated 16-bit sample data
-        ; for the left channel
-        WORD_ARRAY am_AccumL_vw,CACHE_LINE_SIZE
+        ; Contains the current group of accumulated 16-bit sample data for the left channel. Each line is mixed
+        ; at its offset within the group.
+        WORD_ARRAY am_AccumL_vw,AUD_MAX_GROUP_SIZE
 
-        ; Contains the current cache line pair of the accumulated 16-bit sample data
-        ; for the right channel
-        WORD_ARRAY am_AccumR_vw,CACHE_LINE_SIZE
+        ; Contains the current group of accumulated 16-bit sample data for the right channel
+        WORD_ARRAY am_AccumR_vw,AUD_MAX_GROUP_SIZE
 
         ; Pointers to the eventual destination buffers in CHIP ram
         APTR am_LPacketSamplePtr_l ; contains normalised 8-bit sample data for the left channel
@@ -65,4 +76,48 @@ AUD_NUM_CHANNELS    EQU 16
         UBYTE  am_UseMultiplyMixing_b;
         UBYTE  am_UseMultiplyNormalisation_b;
 
+        ULONG  am_PacketCount_l ; number of packets mixed so far
+        APTR   am_TracePtr_l    ; sound event trace being recorded, or null
+
+        ; Master gain, applied by the output stage. Ramped towards the target by the step once per group.
+        UWORD  am_MasterGain_w
+        UWORD  am_MasterGainTarget_w
+        WORD   am_MasterGainStep_w
+
+        ; Number of steps the gain control has lowered the table volume by
+        UWORD  am_GainControlStep_w
+
+        ; Gain control state
+        UWORD  am_MixerVolume_w  ; volume set by Aud_SetMixerVolume
+        UWORD  am_TableVolume_w  ; volume the tables were last generated for
+        UWORD  am_GainHoldCount_w
+        UBYTE  am_UseGainControl_b
+        UBYTE  am_UseStagedOutput_b
+
+        ; Write base pointers. These are the Chip RAM base pointers when writing directly, or the equivalent
+        ; locations in the Fast RAM staging buffer for staged output.
+        APTR am_LPacketSampleWriteBasePtr_l
+        APTR am_LPacketVolumeWriteBasePtr_l
+        APTR am_RPacketSampleWriteBasePtr_l
+        APTR am_RPacketVolumeWriteBasePtr_l
+
+        APTR am_StagingBufferPtr_l ; contains base address of the Fast RAM staging buffer, or null
+
+        UWORD  am_GroupSize_w  ; normalisation group size in samples
+        UWORD  am_GroupShift_w ; log2 of the group size
+
+        ; Group progress. The final group of a packet is short when the packet is not a whole number of groups.
+        UWORD  am_GroupEnd_w          ; byte offset in the accumulators at which the group being mixed is complete
+        UWORD  am_GroupLength_w       ; samples in the group being output
+        UWORD  am_PacketSamplesLeft_w ; samples of the packet from the start of the group being mixed
+
+        APTR   am_StreamPtr_l  ; music stream playing on a reserved channel, or null
+
+        APTR   am_OutputStagePtr_l  ; output stage entry point, entered once per group by Aud_OutputLine
+        APTR   am_OutputBufferPtr_l ; caller supplied 16-bit PCM destination, or null
+        APTR   am_PCMBufferPtr_l    ; mixer allocated 16-bit PCM destination
+        UWORD  am_OutputFormat_w
+
+        APTR   am_PositionModelPtr_l ; positional audio tables, or null
+
         STRUCT_SIZE Aud_Mixer
@@ -8,9 +8,446 @@
         align 4
 
         xdef _asm_sizeof_mixer;
+        xdef Aud_OutputLine
+        xdef _Aud_OutputPaulaHDR
+        xdef _Aud_Output8Bit
+        xdef _Aud_OutputPCM16
+        xdef Aud_FlushStagedOutput
 
         xref _Aud_NormFactors_vw;
 
 
 _asm_sizeof_mixer::
         dc.w Aud_Mixer_SizeOf_l
+
+;//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+;//
+;//  Output dispatch - Shared by all of the mixing kernels and called once per line after mixing.
+;//
+;//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+; The kernels mix each line at its offset within the current normalisation group, given by d7. Once the last line
+; of the group has been mixed, the master gain is stepped and the output stage selected when the mixer was created
+; is entered with the whole group in the accumulation buffers, after which the offset returns to the start of the
+; group. The final group of a packet is short when the packet is not a whole number of groups, so the end of the
+; next group is worked out as each one completes, the output stage taking the length of the completed one from
+; am_GroupLength_w.
+;
+; a0 points at mixer
+; d7.w byte offset of the line just mixed within the group, advanced to that of the next line
+; Trashes d0-d5/a1-a4. Preserves d6, which the kernels use for their line count.
+
+Aud_OutputLine:
+        add.w   #CACHE_LINE_SIZE*2,d7
+        cmp.w   am_GroupEnd_w(a0),d7
+        beq.s   .group_complete
+
+        rts
+
+.group_complete:
+        clr.w   d7
+
+; Group Progress - Set the length of the completed group for the output stage and the end of the next one
+
+        move.w  am_GroupEnd_w(a0),d0
+        lsr.w   #1,d0
+        move.w  d0,am_GroupLength_w(a0) ; samples in the completed group
+        move.w  am_PacketSamplesLeft_w(a0),d1
+        sub.w   d0,d1
+        bne.s   .next_group
+
+        ; That was the final group, so the next one starts the next packet
+        move.w  am_PacketSize_w(a0),d1
+
+.next_group:
+        move.w  d1,am_PacketSamplesLeft_w(a0)
+        move.w  am_GroupSize_w(a0),d0
+        cmp.w   d0,d1
+        bhs.s   .whole_group
+
+        move.w  d1,d0                   ; short final group
+
+.whole_group:
+        add.w   d0,d0
+        move.w  d0,am_GroupEnd_w(a0)
+
+; Gain Ramp - Step the master gain towards the target
+
+        move.w  am_MasterGain_w(a0),d5
+        move.w  am_MasterGainTarget_w(a0),d0
+        cmp.w   d0,d5
+        beq.s   .gain_steady
+
+        add.w   am_MasterGainStep_w(a0),d5
+        tst.w   am_MasterGainStep_w(a0)
+        bmi.s   .gain_ramp_down
+
+        ; Ramping up, clamp at the target
+        cmp.w   d0,d5
+        ble.s   .gain_ramped
+
+        move.w  d0,d5
+        bra.s   .gain_ramped
+
+.gain_ramp_down:
+        ; Ramping down, clamp at the target
+        cmp.w   d0,d5
+        bge.s   .gain_ramped
+
+        move.w  d0,d5
+
+.gain_ramped:
+        move.w  d5,am_MasterGain_w(a0)
+
+.gain_steady:
+        ; d5 contains the master gain for the output stage, which returns to the kernel
+        move.l  am_OutputStagePtr_l(a0),a1
+        jmp     (a1)
+
+;//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+;//
+;//  Paula HDR output stage - Peak analysis and normalisation to 8-bit sample and volume data.
+;//
+;//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+; Master gain is folded into the selection of the normalisation index and factor. Where the gain is not unity, the
+; peak level is scaled by the gain before the index is calculated and the normalisation factor for that index is
+; scaled by the gain too. Power of 2 indexes are converted from a shift to the equivalent factor in that case. The
+; written volume therefore reflects the gain and the 8-bit sample data retain their full range.
+;
+; The gain only exceeds unity while the gain control is compensating for a step in the table volume. The gain for
+; each side is then limited so that the scaled peak still fits in 15 bits.
+;
+; a0 points at mixer
+; d5.w master gain
+; Trashes d0-d5/a1-a4
+
+_Aud_OutputPaulaHDR::
+Aud_OutputPaulaHDR:
+
+; Peak Level Analysis - Find the peak level of the left and right accumulation buffers so that we can normalise
+;                       each one and convert to 8-bit data with a corresponding chanenel volume attenuation.
+;
+        ; Now we need to find the maximum absolute value of each accumulation buffer
+        lea     am_AccumL_vw(a0),a4
+        lea     am_AbsMaxL_w(a0),a2
+
+        ; Same two-step trick as the kernels, we process left then right consecutively
+        moveq  #2,d3
+
+.next_buffer:
+        clr.w   d0 ; d0 will contain the next absolute value from the buffer
+        clr.l   d2
+        move.w  am_GroupLength_w(a0),d1
+
+.next_buffer_value:
+        move.w  (a4)+,d0
+        bge.s   .not_negative
+
+        neg.w   d0
+
+.not_negative:
+        cmp.w   d0,d2
+        bgt.s   .not_bigger
+
+        move.w  d0,d2
+
+.not_bigger:
+        subq.w  #1,d1
+        bne.s   .next_buffer_value
+
+        ; peak value (15 bit)
+        move.w  d2,(a2)+
+        lea     am_AccumR_vw(a0),a4 ; the right accumulator does not follow on from the end of the group
+        subq.w  #1,d3
+        bne.s   .next_buffer
+
+; Normalisation - For each side, determine the index, write the volume word for it and then convert the group
+;                 to 8 bit.
+
+        move.w  d5,d3                   ; master gain in d3, d5 receives the gain for each side
+
+        lea     am_AccumL_vw(a0),a2
+        lea     am_IndexL_w(a0),a3
+        lea     am_LPacketSamplePtr_l(a0),a4
+        move.w  am_AbsMaxL_w(a0),d2
+        bsr.s   .write_side
+
+        lea     am_AccumR_vw(a0),a2
+        lea     am_IndexR_w(a0),a3
+        lea     am_RPacketSamplePtr_l(a0),a4
+        move.w  am_AbsMaxR_w(a0),d2
+
+.write_side:
+        ; Apply the gain to the peak so that the index selects the attenuated level
+        move.w  d3,d5
+        cmp.w   #AUD_UNITY_GAIN,d5
+        beq.s   .unity_peak
+        bls.s   .scale_peak
+
+        ; Above unity, limit the gain if the scaled peak would not fit. The peak cannot be zero here.
+        move.w  d2,d0
+        mulu.w  d5,d0
+        cmp.l   #AUD_MAX_SCALED_PEAK,d0
+        bls.s   .scale_peak
+
+        move.l  #AUD_MAX_SCALED_PEAK,d0
+        divu.w  d2,d0
+        move.w  d0,d5
+
+.scale_peak:
+        mulu.w  d5,d2
+        lsr.l   #8,d2
+
+.unity_peak:
+        ; Now determine the normalisation factor. This is just the 15-bit absolute peak >> 9
+        ; which gives us our offset into the _Aud_NormFactors_vw table
+        lsr.w   #8,d2
+        lsr.w   #1,d2
+        move.w  d2,(a3)
+        move.w  d2,d1
+
+        move.l  4(a4),a1                ; volume packet pointer in a1
+        moveq   #1,d0
+        add.w   d1,d0                   ; i + 1
+        move.w  d0,(a1)+                ; write volume value (SLOW CHIP RAM WRITE, unless staged)
+        move.l  a1,4(a4)                ; updated working volume pointer
+
+        move.l  (a4),a1                 ; destination ptr in a1
+        bsr     Aud_NormaliseGroup
+        move.l  a1,(a4)                 ; update working destination pointer
+        rts
+
+;//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+;//
+;//  Plain 8-bit output stage - Conversion to 8-bit at full scale, without analysis or volume data.
+;//
+;//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+; The group is converted as if normalised for the full volume index, so that only the sample data are written and
+; the channels can be played at a fixed hardware volume.
+;
+; a0 points at mixer
+; d5.w master gain
+; Trashes d0-d4/a1-a4
+
+_Aud_Output8Bit::
+Aud_Output8Bit:
+        lea     am_AccumL_vw(a0),a2
+        lea     am_LPacketSamplePtr_l(a0),a4
+        bsr.s   .write_side
+
+        lea     am_AccumR_vw(a0),a2
+        lea     am_RPacketSamplePtr_l(a0),a4
+
+.write_side:
+        moveq   #AUD_FULL_SCALE_INDEX,d1
+        move.l  (a4),a1                 ; destination ptr in a1
+        bsr     Aud_NormaliseGroup
+        move.l  a1,(a4)                 ; update working destination pointer
+        rts
+
+;//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+;//
+;//  16-bit PCM output stage - Interleaves the accumulated data, without analysis or normalisation.
+;//
+;//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+; The accumulated 16-bit data are final, so they are interleaved left/right into the caller supplied buffer as
+; they are. The master gain is only applied when it is not unity.
+;
+; a0 points at mixer
+; d5.w master gain
+; Trashes d0-d4/a1-a4
+
+_Aud_OutputPCM16::
+Aud_OutputPCM16:
+        move.l  am_LPacketSamplePtr_l(a0),a1 ; interleaved destination ptr in a1
+        lea     am_AccumL_vw(a0),a2
+        lea     am_AccumR_vw(a0),a3
+        move.w  am_GroupLength_w(a0),d4
+
+        cmp.w   #AUD_UNITY_GAIN,d5
+        bne.s   .gain_frame
+
+        lsr.w   #1,d4                   ; we are copying 2 frames per loop
+
+.copy_frames:
+        move.w  (a2)+,d0
+        swap    d0
+        move.w  (a3)+,d0
+        move.l  d0,(a1)+
+        move.w  (a2)+,d0
+        swap    d0
+        move.w  (a3)+,d0
+        move.l  d0,(a1)+
+        subq.w  #1,d4
+        bne.s   .copy_frames
+
+        move.l  a1,am_LPacketSamplePtr_l(a0) ; update working destination pointer
+        rts
+
+.gain_frame:
+        move.w  (a2)+,d0
+        muls.w  d5,d0
+        asr.l   #8,d0
+        swap    d0
+        move.w  (a3)+,d1
+        muls.w  d5,d1
+        asr.l   #8,d1
+        move.w  d1,d0
+        move.l  d0,(a1)+
+        subq.w  #1,d4
+        bne.s   .gain_frame
+
+        move.l  a1,am_LPacketSamplePtr_l(a0) ; update working destination pointer
+        rts
+
+;//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+;//
+;//  Group normalisation - Used by the 8-bit output stages.
+;//
+;//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+; For each 16-bit value in the accumulation buffer, scale by the normalisation value for the index and convert to
+; 8 bit. If the index is one less than a power of 2, the table value is a shift. When the gain is not unity, we
+; always multiply, by the factor scaled by the gain.
+;
+; a0 points at mixer
+; a1 destination, advanced past the group
+; a2 accumulation buffer, advanced past the group
+; d1.w normalisation index
+; d5.w master gain
+; Trashes d0-d2/d4/a3
+
+Aud_NormaliseGroup:
+        lea     _Aud_NormFactors_vw,a3
+        move.w  (a3,d1.w*2),d2          ; d2 contains normalisation factor
+        move.w  am_GroupLength_w(a0),d4
+        lsr.w   #2,d4                   ; we are converting 4 samples per loop
+
+        ; Check for a perfect power of 2..
+        moveq   #1,d0
+        add.w   d1,d0                   ; i + 1
+        and.w   d1,d0                   ; (i + 1) & i
+
+        cmp.w   #AUD_UNITY_GAIN,d5
+        bne.s   .gain_factor
+
+        tst.w   d0
+        beq     .shift_norm_four
+        bra.s   .mul_norm_four
+
+.gain_factor:
+        ; Not unity gain, so we always multiply. For a power of 2, d2 is a shift and the equivalent factor
+        ; is 1 << (16 - shift)
+        tst.w   d0
+        bne.s   .scale_factor
+
+        moveq   #16,d0
+        sub.w   d2,d0
+        moveq   #1,d2
+        lsl.l   d0,d2
+
+.scale_factor:
+        mulu.w  d5,d2                   ; factor * gain
+        lsr.l   #8,d2                   ; / AUD_UNITY_GAIN
+
+        ; Normalisation by multiplication
+        ; We want to nornalise 4 successive 16-bit values so that we can combine them into
+        ; a single 32-bit longword write.
+.mul_norm_four:
+        move.w  (a2)+,d0    ; xx:xx:AA:aa
+        muls.w  d2,d0       ; 00:AA:xx:xx
+        lsr.l   #8,d0       ; 00:00:AA:xx
+        move.w  d0,d1       ; xx:xx:AA:xx
+
+        move.w  (a2)+,d0    ; xx:xx:BB:bb
+        muls.w  d2,d0       ; xx:BB:xx:xx
+        swap    d0          ; xx:xx:xx:BB
+        move.b  d0,d1       ; xx:xx:AA:BB
+        lsl.l   #8,d1       ; xx:AA:BB:00
+
+        move.w  (a2)+,d0    ; xx:xx:CC:cc
+        muls.w  d2,d0       ; xx:CC:xx:xx
+        swap    d0          ; xx:xx:xx:CC
+        move.b  d0,d1       ; xx:AA:BB:CC
+        lsl.l   #8,d1       ; AA:BB:CC:00
+
+        move.w  (a2)+,d0    ; xx:xx:DD:dd
+        muls.w  d2,d0       ; xx:DD:xx:xx
+        swap    d0          ; xx:xx:xx:DD
+        move.b  d0,d1       ; AA:BB:CC:DD
+
+        move.l  d1,(a1)+    ; long slow chip write here, unless staged
+
+        subq.w  #1,d4
+        bne.s   .mul_norm_four
+
+        rts
+
+.shift_norm_four:
+        ; process samples in pairs
+
+        move.l  (a2)+,d0 ; AA:aa:BB:bb
+        lsr.l   d2,d0    ; 00:AA:xx:BB
+        move.l  (a2)+,d1 ; CC:cc:DD:dd
+        lsl.w   #8,d0    ; 00:AA:BB:00
+        lsr.l   d2,d1    ; xx:CC:xx:DD
+        lsl.l   #8,d0    ; AA:BB:00:00
+        lsl.w   #8,d1    ; xx:CC:DD:00
+        lsr.l   #8,d1    ; 00:xx:CC:DD
+        move.w  d1,d0    ; AA:BB:CC:DD
+        move.l  d0,(a1)+ ; long slow chip write here, unless staged
+        subq.w  #1,d4
+        bne.s   .shift_norm_four
+
+        rts
+
+;//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+;//
+;//  Staged output transfer - Called by the kernels at the end of the packet when staged output is enabled.
+;//
+;//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+; The staging buffer has the same layout as the Chip RAM buffer: for each side, the sample data are immediately
+; followed by the volume words, so each side is a single contiguous block of cache lines. Only the lines that
+; were written for this packet are transferred. Using move16 means the Chip RAM writes are issued as line bursts
+; rather than being scattered through the mixing and normalisation work, and nothing is allocated in the data
+; cache for the destination.
+;
+; a0 points at mixer
+; Trashes d0/d1/a1/a2
+
+Aud_FlushStagedOutput:
+        ; Number of lines per side in d1: am_PacketSize bytes of samples plus one volume word per group, rounded
+        ; up to the next whole line
+        move.w  am_GroupShift_w(a0),d0
+        subq.w  #1,d0
+        move.w  am_PacketSize_w(a0),d1
+        lsr.w   d0,d1                   ; am_PacketSize / group * 2 bytes of volume words
+        add.w   #CACHE_LINE_SIZE-1,d1
+        and.w   #~(CACHE_LINE_SIZE-1),d1
+        add.w   am_PacketSize_w(a0),d1
+        lsr.w   #CACHE_LINE_SIZE_EXP,d1
+
+        ; Left
+        move.l  am_LPacketSampleWriteBasePtr_l(a0),a1
+        move.l  am_LPacketSampleBasePtr_l(a0),a2
+        move.w  d1,d0
+
+.flush_left:
+        move16  (a1)+,(a2)+
+        subq.w  #1,d0
+        bne.s   .flush_left
+
+        ; Right
+        move.l  am_RPacketSampleWriteBasePtr_l(a0),a1
+        move.l  am_RPacketSampleBasePtr_l(a0),a2
+
+.flush_right:
+        move16  (a1)+,(a2)+
+        subq.w  #1,d1
+        bne.s   .flush_right
+
+        rts
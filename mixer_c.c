@@ -0,0 +1,257 @@
+#include "mixer.h"
+#include <string.h>
+
+/**
+ * Portable C implementation of the packet mixer. This follows the same sequence of operations as
+ * Aud_MixPacket_060 (multiplication mixing) and the shared output stages (multiplication/shift normalisation with
+ * the master gain folded in, or plain 16-bit output) and produces bit identical output. It serves as the reference
+ * for the assembler kernels and allows traces to be replayed on a host.
+ */
+
+extern WORD Aud_NormFactors_vw[64];
+
+/**
+ * Peak level analysis, as performed by the assembler kernels. Note that -32768 does not have a representable
+ * absolute value and is ignored, exactly as the neg.w / cmp.w sequence does.
+ */
+static UWORD PeakLevel(WORD const* accum, UWORD count)
+{
+    WORD peak = 0;
+    for (int i = 0; i < count; ++i) {
+        WORD value = accum[i] < 0 ? (WORD)-accum[i] : accum[i];
+        if (value >= peak) {
+            peak = value;
+        }
+    }
+    return (UWORD)peak;
+}
+
+/**
+ * Step the master gain towards the target, once per group.
+ */
+static UWORD RampGain(Aud_Mixer* mixer)
+{
+    WORD gain   = (WORD)mixer->am_MasterGain;
+    WORD target = (WORD)mixer->am_MasterGainTarget;
+    if (gain != target) {
+        gain += mixer->am_MasterGainStep;
+        if (mixer->am_MasterGainStep < 0 ? gain < target : gain > target) {
+            gain = target;
+        }
+        mixer->am_MasterGain = (UWORD)gain;
+    }
+    return (UWORD)gain;
+}
+
+/**
+ * Gain for one side of a group. Above unity, which only happens while the gain control is compensating for a
+ * table volume step, the gain is limited so that the scaled peak still fits in 15 bits.
+ */
+static UWORD SideGain(UWORD peak, UWORD gain)
+{
+    if (gain > AUD_UNITY_GAIN && (ULONG)peak * gain > AUD_MAX_SCALED_PEAK) {
+        gain = (UWORD)(AUD_MAX_SCALED_PEAK / peak);
+    }
+    return gain;
+}
+
+/**
+ * Normalisation index for the given peak. The gain is folded in by scaling the peak.
+ */
+static UWORD NormIndex(UWORD peak, UWORD gain)
+{
+    if (gain != AUD_UNITY_GAIN) {
+        peak = (UWORD)(((ULONG)peak * gain) >> 8);
+    }
+    return peak >> 9;
+}
+
+/**
+ * Normalise one group of 16-bit accumulated data to 8-bit for the given index. When the gain is not unity, the
+ * factor for the index is scaled by the gain and multiplication is always used.
+ */
+static void NormaliseGroup(
+    WORD const* accum,
+    UWORD count,
+    UWORD index,
+    UWORD gain,
+    BYTE** samplePtr
+)
+{
+    BYTE* dst    = *samplePtr;
+    WORD  factor = Aud_NormFactors_vw[index];
+    BOOL  shift  = !((index + 1) & index);
+
+    if (gain != AUD_UNITY_GAIN) {
+        ULONG scaled = shift ? (1UL << (16 - factor)) : (UWORD)factor;
+        factor = (WORD)((scaled * gain) >> 8);
+        shift  = FALSE;
+    }
+
+    if (!shift) {
+        for (int i = 0; i < count; ++i) {
+            dst[i] = (BYTE)(((LONG)accum[i] * factor) >> 16);
+        }
+    } else {
+        for (int i = 0; i < count; ++i) {
+            dst[i] = (BYTE)((UWORD)accum[i] >> factor);
+        }
+    }
+    *samplePtr = dst + count;
+}
+
+/**
+ * Paula HDR output stage. Peak analysis, then a volume word and normalised 8-bit data for each side.
+ */
+static void OutputPaulaHDR(Aud_Mixer* mixer, UWORD gain)
+{
+    UWORD group_size = mixer->am_GroupLength;
+
+    mixer->am_AbsMaxL = PeakLevel(mixer->am_AccumL, group_size);
+    mixer->am_AbsMaxR = PeakLevel(mixer->am_AccumR, group_size);
+
+    UWORD gain_l = SideGain(mixer->am_AbsMaxL, gain);
+    UWORD gain_r = SideGain(mixer->am_AbsMaxR, gain);
+
+    mixer->am_IndexL = NormIndex(mixer->am_AbsMaxL, gain_l);
+    mixer->am_IndexR = NormIndex(mixer->am_AbsMaxR, gain_r);
+
+    *mixer->am_LeftPacketVolumePtr++  = mixer->am_IndexL + 1;
+    *mixer->am_RightPacketVolumePtr++ = mixer->am_IndexR + 1;
+
+    NormaliseGroup(mixer->am_AccumL, group_size, mixer->am_IndexL, gain_l, &mixer->am_LeftPacketSamplePtr);
+    NormaliseGroup(mixer->am_AccumR, group_size, mixer->am_IndexR, gain_r, &mixer->am_RightPacketSamplePtr);
+}
+
+/**
+ * Plain 8-bit output stage. Normalised for the full volume index, without analysis or volume data.
+ */
+static void Output8Bit(Aud_Mixer* mixer, UWORD gain)
+{
+    UWORD group_size = mixer->am_GroupLength;
+
+    NormaliseGroup(mixer->am_AccumL, group_size, AUD_FULL_SCALE_INDEX, gain, &mixer->am_LeftPacketSamplePtr);
+    NormaliseGroup(mixer->am_AccumR, group_size, AUD_FULL_SCALE_INDEX, gain, &mixer->am_RightPacketSamplePtr);
+}
+
+/**
+ * 16-bit PCM output stage. The accumulated data are interleaved as they are, scaled only when the gain is not
+ * unity.
+ */
+static void OutputPCM16(Aud_Mixer* mixer, UWORD gain)
+{
+    WORD* dst = (WORD*)mixer->am_LeftPacketSamplePtr;
+
+    for (int i = 0; i < mixer->am_GroupLength; ++i) {
+        if (gain != AUD_UNITY_GAIN) {
+            *dst++ = (WORD)(((LONG)mixer->am_AccumL[i] * (WORD)gain) >> 8);
+            *dst++ = (WORD)(((LONG)mixer->am_AccumR[i] * (WORD)gain) >> 8);
+        } else {
+            *dst++ = mixer->am_AccumL[i];
+            *dst++ = mixer->am_AccumR[i];
+        }
+    }
+    mixer->am_LeftPacketSamplePtr = (BYTE*)dst;
+}
+
+/**
+ * Sets the length of the completed group for the output stage and the end of the next one, which is short when
+ * fewer than a whole group of the packet remain.
+ */
+static void NextGroup(Aud_Mixer* mixer)
+{
+    UWORD length = mixer->am_GroupEnd >> 1;
+    UWORD left   = mixer->am_PacketSamplesLeft - length;
+
+    mixer->am_GroupLength = length;
+    if (!left) {
+        // That was the final group, so the next one starts the next packet
+        left = mixer->am_PacketSize;
+    }
+    mixer->am_PacketSamplesLeft = left;
+    mixer->am_GroupEnd          = (left < mixer->am_GroupSize ? left : mixer->am_GroupSize) << 1;
+}
+
+void Aud_MixPacket_C(REG(a0, Aud_Mixer* mixer))
+{
+    ++mixer->am_PacketCount;
+
+    mixer->am_LeftPacketSamplePtr  = mixer->am_LeftPacketSampleWriteBasePtr;
+    mixer->am_LeftPacketVolumePtr  = mixer->am_LeftPacketVolumeWriteBasePtr;
+    mixer->am_RightPacketSamplePtr = mixer->am_RightPacketSampleWriteBasePtr;
+    mixer->am_RightPacketVolumePtr = mixer->am_RightPacketVolumeWriteBasePtr;
+
+    UWORD offset = 0; // offset of the current line within the group
+
+    for (UWORD line = mixer->am_PacketSize >> 4; line > 0; --line) {
+        WORD* accum_l = mixer->am_AccumL + offset;
+        WORD* accum_r = mixer->am_AccumR + offset;
+
+        memset(accum_l, 0, CACHE_LINE_SIZE * sizeof(WORD));
+        memset(accum_r, 0, CACHE_LINE_SIZE * sizeof(WORD));
+
+        for (int channel = 0; channel < AUD_NUM_CHANNELS; ++channel) {
+            Aud_ChannelState* state = &mixer->am_ChannelState[channel];
+            if (!state->ac_SamplePtr || !state->ac_SamplesLeft) {
+                continue;
+            }
+
+            UWORD left  = state->ac_LeftVolume  & 0x0F;
+            UWORD right = state->ac_RightVolume & 0x0F;
+
+            if (left || right) {
+                memcpy(mixer->am_FetchBuffer, state->ac_SamplePtr, CACHE_LINE_SIZE);
+                if (left) {
+                    WORD scale = mixer->am_VolumeScale[left];
+                    for (int i = 0; i < CACHE_LINE_SIZE; ++i) {
+                        accum_l[i] = (WORD)(accum_l[i] + mixer->am_FetchBuffer[i] * scale);
+                    }
+                }
+                if (right) {
+                    WORD scale = mixer->am_VolumeScale[right];
+                    for (int i = 0; i < CACHE_LINE_SIZE; ++i) {
+                        accum_r[i] = (WORD)(accum_r[i] + mixer->am_FetchBuffer[i] * scale);
+                    }
+                }
+            }
+
+            state->ac_SamplesLeft -= CACHE_LINE_SIZE;
+            if (state->ac_SamplesLeft) {
+                state->ac_SamplePtr += CACHE_LINE_SIZE;
+            } else {
+                state->ac_SamplePtr   = NULL;
+                state->ac_LeftVolume  = 0;
+                state->ac_RightVolume = 0;
+            }
+        }
+
+        // Nothing more to do until the last line of the group has been mixed
+        offset += CACHE_LINE_SIZE;
+        if (offset * sizeof(WORD) < mixer->am_GroupEnd) {
+            continue;
+        }
+        offset = 0;
+        NextGroup(mixer);
+
+        UWORD gain = RampGain(mixer);
+
+        switch (mixer->am_OutputFormat) {
+            case AUD_OUTPUT_PAULA_HDR:
+                OutputPaulaHDR(mixer, gain);
+                break;
+            case AUD_OUTPUT_8BIT:
+                Output8Bit(mixer, gain);
+                break;
+            case AUD_OUTPUT_PCM16:
+                OutputPCM16(mixer, gain);
+                break;
+        }
+    }
+
+    if (mixer->am_UseStagedOutput) {
+        // Each side is a contiguous run of sample data followed by the volume words
+        size_t size = mixer->am_PacketSize + CacheAlign((mixer->am_PacketSize >> mixer->am_GroupShift) * sizeof(UWORD));
+        memcpy(mixer->am_LeftPacketSampleBasePtr,  mixer->am_LeftPacketSampleWriteBasePtr,  size);
+        memcpy(mixer->am_RightPacketSampleBasePtr, mixer->am_RightPacketSampleWriteBasePtr, size);
+    }
+}
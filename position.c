@@ -0,0 +1,184 @@
+#include "position.h"
+#ifndef AUD_HOST_BUILD
+#include <proto/exec.h>
+#endif
+
+/**
+ * Integer square root, only used when generating the tables.
+ */
+static ULONG ISqrt(ULONG value)
+{
+    ULONG root = 0;
+    ULONG bit  = 1UL << 30;
+    while (bit > value) {
+        bit >>= 2;
+    }
+    while (bit) {
+        if (value >= root + bit) {
+            value -= root + bit;
+            root   = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+    return root;
+}
+
+/**
+ * Squared distance to attenuation table bucket. Below 4 the squared distance is the bucket, otherwise the exponent
+ * selects a group of 4 buckets and the 2 bits below the leading one select within it.
+ */
+static inline UWORD DistanceBucket(ULONG dist2)
+{
+    if (dist2 < 4) {
+        return (UWORD)dist2;
+    }
+    UWORD exponent = 31 - __builtin_clz(dist2);
+    return (exponent << 2) | ((dist2 >> (exponent - 2)) & 3);
+}
+
+/**
+ * The squared distance at the middle of each bucket, for generating the table.
+ */
+static ULONG BucketDistance2(UWORD bucket)
+{
+    if (bucket < 8) {
+        return bucket < 4 ? bucket : 4;
+    }
+    UWORD exponent = bucket >> 2;
+    ULONG step     = 1UL << (exponent - 2);
+    return ((4 | (bucket & 3)) << (exponent - 2)) + (step >> 1);
+}
+
+static void GenerateAttenuation(Aud_PositionModel* model)
+{
+    ULONG ref_distance = model->ap_RefDistance;
+    ULONG max_distance = model->ap_MaxDistance;
+
+    for (UWORD bucket = 0; bucket < AUD_POS_DISTANCE_STEPS; ++bucket) {
+        ULONG distance = ISqrt(BucketDistance2(bucket));
+        UBYTE level;
+        if (distance <= ref_distance) {
+            level = 255;
+        } else if (distance >= max_distance) {
+            level = 0;
+        } else {
+            level = (UBYTE)((255 * (max_distance - distance)) / (max_distance - ref_distance));
+        }
+        model->ap_Attenuation[bucket] = level;
+    }
+}
+
+/**
+ * The pan table is indexed by the quantised (ahead, right) offset, each a signed AUD_POS_DIRECTION_BITS value.
+ * The nearer ear is always at full level and the far one falls linearly with the sine of the angle to the side,
+ * down to AUD_POS_FAR_EAR_LEVEL.
+ */
+static void GeneratePan(Aud_PositionModel* model)
+{
+    for (UWORD index = 0; index < AUD_POS_DIRECTION_STEPS * AUD_POS_DIRECTION_STEPS; ++index) {
+        LONG ahead = (LONG)(index >> AUD_POS_DIRECTION_BITS);
+        LONG right = (LONG)(index & AUD_POS_DIRECTION_MASK);
+        if (ahead >= AUD_POS_DIRECTION_STEPS / 2) {
+            ahead -= AUD_POS_DIRECTION_STEPS;
+        }
+        if (right >= AUD_POS_DIRECTION_STEPS / 2) {
+            right -= AUD_POS_DIRECTION_STEPS;
+        }
+
+        // Sine of the angle to the side, 8 bit fraction
+        LONG length = (LONG)ISqrt((ULONG)(ahead * ahead + right * right) << 16);
+        LONG side   = length ? (right << 16) / length : 0;
+        LONG far    = 255 - (((side < 0 ? -side : side) * (255 - AUD_POS_FAR_EAR_LEVEL)) >> 8);
+
+        model->ap_Pan[index][0] = (UBYTE)(side > 0 ? far : 255);
+        model->ap_Pan[index][1] = (UBYTE)(side < 0 ? far : 255);
+    }
+}
+
+BOOL Aud_SetPositionModel(
+    REG(a0, Aud_Mixer* mixer),
+    REG(d0, UWORD refDistance),
+    REG(d1, UWORD maxDistance)
+)
+{
+    if (maxDistance <= refDistance) {
+        return FALSE;
+    }
+
+    Aud_PositionModel* model = mixer->am_PositionModelPtr;
+    if (!model) {
+        model = (Aud_PositionModel*)AllocCacheAligned(sizeof(Aud_PositionModel), MEMF_ANY);
+        if (!model) {
+            return FALSE;
+        }
+        mixer->am_PositionModelPtr = model;
+    }
+
+    model->ap_RefDistance = refDistance;
+    model->ap_MaxDistance = maxDistance;
+    GenerateAttenuation(model);
+    GeneratePan(model);
+    return TRUE;
+}
+
+void Aud_FreePositionModel(
+    REG(a0, Aud_Mixer* mixer)
+)
+{
+    FreeCacheAligned(mixer->am_PositionModelPtr);
+    mixer->am_PositionModelPtr = NULL;
+}
+
+void Aud_UpdatePositions(
+    REG(a0, Aud_Mixer* mixer),
+    REG(a1, Aud_Listener const* listener),
+    REG(a2, Aud_Emitter const* emitters),
+    REG(d0, UWORD numEmitters)
+)
+{
+    Aud_PositionModel const* model = mixer->am_PositionModelPtr;
+    if (!model) {
+        return;
+    }
+
+    LONG facing_x = listener->al_FacingX;
+    LONG facing_z = listener->al_FacingZ;
+
+    for (UWORD i = 0; i < numEmitters; ++i) {
+        Aud_Emitter const* emitter = &emitters[i];
+
+        // Clamp the offset so that the squared distance fits in 32 bits
+        LONG dx = (LONG)emitter->ae_X - listener->al_X;
+        LONG dz = (LONG)emitter->ae_Z - listener->al_Z;
+        dx = dx > 32767 ? 32767 : dx < -32767 ? -32767 : dx;
+        dz = dz > 32767 ? 32767 : dz < -32767 ? -32767 : dz;
+
+        UWORD left  = 0;
+        UWORD right = 0;
+        ULONG level = model->ap_Attenuation[DistanceBucket((ULONG)(dx * dx) + (ULONG)(dz * dz))];
+
+        if (level) {
+            // Rotate into the listener's frame and reduce to the pan table range
+            LONG side  = (dx * facing_z - dz * facing_x) >> AUD_POS_FACING_SHIFT;
+            LONG ahead = (dx * facing_x + dz * facing_z) >> AUD_POS_FACING_SHIFT;
+            while (
+                side  >= AUD_POS_DIRECTION_STEPS / 2 || side  < -AUD_POS_DIRECTION_STEPS / 2 ||
+                ahead >= AUD_POS_DIRECTION_STEPS / 2 || ahead < -AUD_POS_DIRECTION_STEPS / 2
+            ) {
+                side  >>= 1;
+                ahead >>= 1;
+            }
+            UBYTE const* pan = model->ap_Pan[
+                ((ahead & AUD_POS_DIRECTION_MASK) << AUD_POS_DIRECTION_BITS) | (side & AUD_POS_DIRECTION_MASK)
+            ];
+
+            // 255 * 255 * 16 >> 16 gives at most 15
+            level *= (emitter->ae_Volume & 0x0F) + 1;
+            left   = (UWORD)((level * pan[0]) >> 16);
+            right  = (UWORD)((level * pan[1]) >> 16);
+        }
+        Aud_SetChannelVolume(mixer, emitter->ae_Channel, left, right);
+    }
+}
@@ -0,0 +1,85 @@
+#ifndef _TKG_POSITION_H_
+#define _TKG_POSITION_H_
+
+#include "mixer.h"
+
+/**
+ * Positional audio
+ *
+ * Computes the left/right volume pairs of a batch of voices from the listener and emitter positions, in the
+ * horizontal (X/Z) plane, and applies them to the channels before the next packet is mixed. With the listener
+ * facing +Z, +X is to the right.
+ *
+ * All of the expensive work is done once, when the position model is set, by precomputing two tables:
+ *
+ * - Attenuation, keyed on the squared distance. The squared distance is reduced to a bucket from its exponent and
+ *   the next two bits, giving four steps per doubling, so the distance itself is never needed.
+ *
+ * - Pan, keyed on the direction of the emitter relative to the listener facing. The rotated offset is shifted down
+ *   until both components fit in AUD_POS_DIRECTION_BITS signed bits and the pair is used as the index.
+ *
+ * Each update is then a rotation by the facing vector, a handful of shifts and the lookups, with no divides or
+ * trigonometry per voice.
+ */
+
+#define AUD_POS_DIRECTION_BITS  4
+#define AUD_POS_DIRECTION_STEPS (1 << AUD_POS_DIRECTION_BITS)
+#define AUD_POS_DIRECTION_MASK  (AUD_POS_DIRECTION_STEPS - 1)
+#define AUD_POS_DISTANCE_STEPS  128 // 4 per power of 2 of the 32-bit squared distance
+
+// Fixed point 1.0 for the components of the listener facing vector
+#define AUD_POS_FACING_ONE      16384
+#define AUD_POS_FACING_SHIFT    14
+
+// Level of the far ear for a sound directly to one side, 0-255. Keeps hard panned sounds audible in both ears.
+#define AUD_POS_FAR_EAR_LEVEL   64
+
+typedef struct {
+    WORD  al_X;
+    WORD  al_Z;
+    WORD  al_FacingX; // Unit facing vector, AUD_POS_FACING_ONE fixed point
+    WORD  al_FacingZ;
+} Aud_Listener;
+
+typedef struct {
+    WORD  ae_X;
+    WORD  ae_Z;
+    UWORD ae_Channel;
+    UWORD ae_Volume;  // 0-15, volume of the sound at or within the reference distance
+} Aud_Emitter;
+
+typedef struct Aud_PositionModel {
+    UBYTE ap_Attenuation[AUD_POS_DISTANCE_STEPS];                        // 0-255, by squared distance bucket
+    UBYTE ap_Pan[AUD_POS_DIRECTION_STEPS * AUD_POS_DIRECTION_STEPS][2];  // 0-255 left/right, by direction
+    UWORD ap_RefDistance;
+    UWORD ap_MaxDistance;
+} Aud_PositionModel;
+
+/**
+ * Sets the distance model, generating the tables. Sounds are at full volume up to the reference distance and fall
+ * off linearly to silence at the maximum distance. Returns FALSE if the model could not be allocated or the
+ * maximum distance does not exceed the reference distance.
+ */
+extern BOOL Aud_SetPositionModel(
+    REG(a0, Aud_Mixer* mixer),
+    REG(d0, UWORD refDistance),
+    REG(d1, UWORD maxDistance)
+);
+
+extern void Aud_FreePositionModel(
+    REG(a0, Aud_Mixer* mixer)
+);
+
+/**
+ * Computes the volumes for each emitter and applies them to its channel with Aud_SetChannelVolume(), so they are
+ * recorded by an attached trace and a channel reserved by a stream is left alone. Does nothing until a position
+ * model has been set.
+ */
+extern void Aud_UpdatePositions(
+    REG(a0, Aud_Mixer* mixer),
+    REG(a1, Aud_Listener const* listener),
+    REG(a2, Aud_Emitter const* emitters),
+    REG(d0, UWORD numEmitters)
+);
+
+#endif
@@ -0,0 +1,519 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mixer.h"
+#include "trace.h"
+
+/**
+ * Trace replay driver. Loads a trace recorded with Aud_OpenTrace(), then for each selected kernel, replays the
+ * trace from the start, timing every packet and computing a checksum over the output buffers. Each kernel is
+ * replayed with direct and with staged output, which should produce identical checksums. The 16-bit PCM output
+ * format is only replayed direct.
+ *
+ * Usage: replay <trace file> [<kernel>|all] [<expected checksum>|-] [<group size>] [hdr|8bit|pcm16] [unity|fade|agc]
+ *
+ * If an expected checksum (hex) is given, the return code is 10 when any replayed kernel does not match it. The
+ * normalisation group size defaults to AUD_DEFAULT_GROUP_SIZE. Other group sizes may change the packet size, in
+ * which case the events are applied at the same packet indexes as recorded rather than the same sample positions.
+ * The output format defaults to Paula HDR.
+ *
+ * The gain mode defaults to unity. With fade, the master gain is ramped continuously between unity and
+ * REPLAY_FADE_GAIN, over REPLAY_FADE_PACKETS each way. With agc, the gain control is enabled and updated before
+ * each packet, which takes the master gain above unity after each step down. Only the mixing is timed in either
+ * case.
+ */
+
+#ifdef AUD_HOST_BUILD
+
+#include <time.h>
+
+typedef unsigned long long ULONG64;
+
+static ULONG64 clock_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (ULONG64)now.tv_sec * 1000000000ULL + (ULONG64)now.tv_nsec;
+}
+
+static ULONG64 clock_freq_hz = 1000000000ULL;
+
+static BOOL init_clock(void)
+{
+    return TRUE;
+}
+
+static void free_clock(void)
+{
+}
+
+#else
+
+#include <proto/exec.h>
+#include <devices/timer.h>
+#include <proto/timer.h>
+
+typedef unsigned long long ULONG64;
+
+typedef union {
+    struct EClockVal ecv;
+    ULONG64 ticks;
+} ClockValue;
+
+static struct TimeRequest time_request;
+struct Device* TimerBase = NULL;
+static ULONG64 clock_freq_hz = 0;
+
+static ULONG64 clock_now(void)
+{
+    ClockValue now;
+    ReadEClock(&now.ecv);
+    return now.ticks;
+}
+
+static BOOL init_clock(void)
+{
+    if (OpenDevice(TIMERNAME, UNIT_MICROHZ, &time_request.tr_node, 0) != 0) {
+        return FALSE;
+    }
+    TimerBase = time_request.tr_node.io_Device;
+
+    ClockValue now;
+    clock_freq_hz = ReadEClock(&now.ecv);
+    return TRUE;
+}
+
+static void free_clock(void)
+{
+    if (TimerBase) {
+        CloseDevice(&time_request.tr_node);
+        TimerBase = NULL;
+    }
+}
+
+#endif
+
+#define SOUND_DIR "sounds"
+
+typedef void (*Mix_Function)(REG(a0, Aud_Mixer* mixer));
+
+typedef struct {
+    Mix_Function mix_function;
+    char const*  name;
+    BOOL         pre_encoded;
+} Kernel;
+
+static Kernel const kernels[] = {
+    { Aud_MixPacket_C,           "c",           FALSE },
+#ifndef AUD_HOST_BUILD
+    { Aud_MixPacket_060,         "060",         FALSE },
+    { Aud_MixPacket_040Shifted,  "040shifted",  FALSE },
+    { Aud_MixPacket_040Linear,   "040linear",   FALSE },
+    { Aud_MixPacket_040Delta,    "040delta",    FALSE },
+    { Aud_MixPacket_040PreDelta, "040predelta", TRUE  },
+#endif
+};
+
+#define NUM_KERNELS (sizeof(kernels)/sizeof(Kernel))
+
+typedef struct {
+    BYTE* s_dataPtr;
+    BYTE* s_encodedPtr;
+    ULONG s_length;
+} Sound;
+
+static Sound sounds[AUD_TRACE_MAX_SOUNDS];
+
+static UBYTE* trace_data = NULL;
+static ULONG  trace_size = 0;
+
+static BOOL load_trace(char const* file_name)
+{
+    FILE* file = fopen(file_name, "rb");
+    if (!file) {
+        return FALSE;
+    }
+    fseek(file, 0, SEEK_END);
+    trace_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    trace_data = (UBYTE*)malloc(trace_size);
+    BOOL result = trace_data && trace_size == fread(trace_data, 1, trace_size, file);
+    fclose(file);
+    return result;
+}
+
+static BOOL load_sound(char const* name, ULONG length, Sound* sound)
+{
+    char path[sizeof(SOUND_DIR) + AUD_TRACE_MAX_NAME + 1];
+    snprintf(path, sizeof(path), SOUND_DIR "/%s", name);
+
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        printf("Could not open %s\n", path);
+        return FALSE;
+    }
+
+    // The recorded length is authoritative, as that is what the game played
+    sound->s_length     = CacheAlign(length);
+    sound->s_dataPtr    = AllocCacheAligned(sound->s_length, MEMF_FAST|MEMF_CLEAR);
+    sound->s_encodedPtr = AllocCacheAligned(sound->s_length, MEMF_FAST);
+
+    // The recorded length may include padding to a whole cache line beyond the end of the file, which stays clear
+    BOOL result = sound->s_dataPtr && sound->s_encodedPtr &&
+        fread(sound->s_dataPtr, 1, length, file) + CACHE_LINE_SIZE > length;
+    if (!result) {
+        printf("Could not read %lu bytes from %s\n", (unsigned long)length, path);
+    } else {
+        CopyMem(sound->s_dataPtr, sound->s_encodedPtr, sound->s_length);
+
+        // L1D15 pre-encoding, as expected by Aud_MixPacket_040PreDelta
+        BYTE* p_data = sound->s_encodedPtr;
+        for (ULONG f = sound->s_length >> 4; f > 0; --f) {
+            for (int i = 15; i > 0; --i) {
+                p_data[i] -= p_data[i - 1];
+            }
+            p_data += CACHE_LINE_SIZE;
+        }
+    }
+    fclose(file);
+    return result;
+}
+
+static void free_sounds(void)
+{
+    for (int i = 0; i < AUD_TRACE_MAX_SOUNDS; ++i) {
+        FreeCacheAligned(sounds[i].s_dataPtr);
+        FreeCacheAligned(sounds[i].s_encodedPtr);
+        sounds[i].s_dataPtr    = NULL;
+        sounds[i].s_encodedPtr = NULL;
+    }
+}
+
+/**
+ * Pre-pass over the trace to load every sound it defines.
+ */
+static BOOL load_trace_sounds(ULONG offset)
+{
+    Aud_TraceEvent event;
+    char name[AUD_TRACE_MAX_NAME + 1];
+    memset(&event, 0, sizeof(event));
+
+    while ((offset = Aud_DecodeTraceEvent(trace_data, trace_size, offset, &event, name))) {
+        if (AUD_TRACE_DEFINE == event.te_Type) {
+            if (event.te_Sound >= AUD_TRACE_MAX_SOUNDS || sounds[event.te_Sound].s_dataPtr) {
+                printf("Bad sound id %hu\n", event.te_Sound);
+                return FALSE;
+            }
+            if (!load_sound(name, event.te_Offset, &sounds[event.te_Sound])) {
+                return FALSE;
+            }
+        }
+    }
+    return TRUE;
+}
+
+/**
+ * FNV-1a, folded over the packet output buffers
+ */
+static ULONG checksum(ULONG hash, UBYTE const* data, ULONG size)
+{
+    while (size--) {
+        hash = (hash ^ *data++) * 16777619UL;
+    }
+    return hash;
+}
+
+static ULONG checksum_packet(Aud_Mixer const* mixer, ULONG hash)
+{
+    if (AUD_OUTPUT_PCM16 == mixer->am_OutputFormat) {
+        // Interleaved frames of two words
+        return checksum(hash, (UBYTE const*)mixer->am_LeftPacketSampleBasePtr, (ULONG)mixer->am_PacketSize << 2);
+    }
+    hash = checksum(hash, (UBYTE const*)mixer->am_LeftPacketSampleBasePtr,  mixer->am_PacketSize);
+    hash = checksum(hash, (UBYTE const*)mixer->am_RightPacketSampleBasePtr, mixer->am_PacketSize);
+    if (AUD_OUTPUT_8BIT == mixer->am_OutputFormat) {
+        return hash;
+    }
+    ULONG volume_size = (mixer->am_PacketSize >> mixer->am_GroupShift) * sizeof(UWORD);
+    hash = checksum(hash, (UBYTE const*)mixer->am_LeftPacketVolumeBasePtr,  volume_size);
+    hash = checksum(hash, (UBYTE const*)mixer->am_RightPacketVolumeBasePtr, volume_size);
+    return hash;
+}
+
+static char const* const output_format_names[AUD_NUM_OUTPUT_FORMATS] = { "hdr", "8bit", "pcm16" };
+
+enum {
+    GAIN_UNITY = 0,
+    GAIN_FADE,
+    GAIN_AGC,
+    NUM_GAIN_MODES
+};
+
+static char const* const gain_mode_names[NUM_GAIN_MODES] = { "unity", "fade", "agc" };
+
+#define REPLAY_FADE_GAIN    (AUD_UNITY_GAIN / 4)
+#define REPLAY_FADE_PACKETS 25
+
+/**
+ * Applies the gain mode before each packet
+ */
+static void update_gain(Aud_Mixer* mixer, UWORD gain_mode)
+{
+    if (GAIN_FADE == gain_mode && mixer->am_MasterGain == mixer->am_MasterGainTarget) {
+        Aud_SetMasterGain(
+            mixer,
+            AUD_UNITY_GAIN == mixer->am_MasterGain ? REPLAY_FADE_GAIN : AUD_UNITY_GAIN,
+            REPLAY_FADE_PACKETS
+        );
+    } else if (GAIN_AGC == gain_mode) {
+        Aud_UpdateGainControl(mixer);
+    }
+}
+
+static void apply_event(Aud_Mixer* mixer, Aud_TraceEvent const* event, BOOL pre_encoded, ULONG* lost)
+{
+    switch (event->te_Type) {
+        case AUD_TRACE_START: {
+            Sound const* sound = &sounds[event->te_Sound];
+            if (event->te_Sound < AUD_TRACE_MAX_SOUNDS && sound->s_dataPtr && event->te_Offset < sound->s_length) {
+                // Play the recorded length, where the trace has one, within the bounds of the loaded sound
+                ULONG length = sound->s_length - event->te_Offset;
+                if (AUD_TRACE_NO_LENGTH != event->te_Length && event->te_Length < length) {
+                    length = event->te_Length;
+                }
+                Aud_StartChannel(
+                    mixer,
+                    (pre_encoded ? sound->s_encodedPtr : sound->s_dataPtr) + event->te_Offset,
+                    event->te_Channel,
+                    (UWORD)length,
+                    event->te_LeftVolume,
+                    event->te_RightVolume
+                );
+            }
+            break;
+        }
+        case AUD_TRACE_LOST:
+            // The recorded start replaced whatever was playing on the channel, but cannot itself be replayed
+            Aud_StopChannel(mixer, event->te_Channel);
+            ++*lost;
+            break;
+        case AUD_TRACE_STOP:
+            Aud_StopChannel(mixer, event->te_Channel);
+            break;
+        case AUD_TRACE_VOLUME:
+            Aud_SetChannelVolume(mixer, event->te_Channel, event->te_LeftVolume, event->te_RightVolume);
+            break;
+        default:
+            break;
+    }
+}
+
+typedef struct {
+    ULONG   rr_packets;
+    ULONG   rr_lost;      // starts of unregistered sounds that could not be replayed
+    ULONG   rr_checksum;
+    ULONG64 rr_ticks;
+    ULONG64 rr_maxTicks;
+} ReplayResult;
+
+static void replay(Aud_Mixer* mixer, Kernel const* kernel, UWORD gain_mode, ULONG offset, ReplayResult* result)
+{
+    Aud_TraceEvent event;
+    char name[AUD_TRACE_MAX_NAME + 1];
+    memset(&event, 0, sizeof(event));
+
+    for (int chan = 0; chan < AUD_NUM_CHANNELS; ++chan) {
+        Aud_StopChannel(mixer, chan);
+    }
+    mixer->am_PacketCount = 0;
+
+    // Every replay starts from the full table volume at unity gain
+    if (GAIN_AGC == gain_mode) {
+        Aud_EnableGainControl(mixer, FALSE);
+        Aud_EnableGainControl(mixer, TRUE);
+    }
+    Aud_SetMasterGain(mixer, AUD_UNITY_GAIN, 0);
+
+    result->rr_packets  = 0;
+    result->rr_lost     = 0;
+    result->rr_checksum = 2166136261UL;
+    result->rr_ticks    = 0;
+    result->rr_maxTicks = 0;
+
+    while ((offset = Aud_DecodeTraceEvent(trace_data, trace_size, offset, &event, name))) {
+        // Mix up to the packet this event applies before
+        while (mixer->am_PacketCount < event.te_Packet) {
+            update_gain(mixer, gain_mode);
+
+            ULONG64 begin = clock_now();
+            kernel->mix_function(mixer);
+            ULONG64 ticks = clock_now() - begin;
+
+            result->rr_ticks += ticks;
+            if (ticks > result->rr_maxTicks) {
+                result->rr_maxTicks = ticks;
+            }
+            result->rr_checksum = checksum_packet(mixer, result->rr_checksum);
+            ++result->rr_packets;
+        }
+        if (AUD_TRACE_END == event.te_Type) {
+            break;
+        }
+        apply_event(mixer, &event, kernel->pre_encoded, &result->rr_lost);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2) {
+        puts(
+            "Usage: replay <trace file> [<kernel>|all] [<expected checksum>|-] [<group size>] [hdr|8bit|pcm16] "
+            "[unity|fade|agc]"
+        );
+        return 20;
+    }
+
+    char const* kernel_name = argc > 2 ? argv[2] : "all";
+    BOOL  check_expected = argc > 3 && strcmp(argv[3], "-");
+    ULONG expected       = check_expected ? strtoul(argv[3], NULL, 16) : 0;
+    UWORD group_size     = argc > 4 ? (UWORD)strtoul(argv[4], NULL, 10) : AUD_DEFAULT_GROUP_SIZE;
+    UWORD output_format  = AUD_OUTPUT_PAULA_HDR;
+    UWORD gain_mode      = GAIN_UNITY;
+
+    if (argc > 5) {
+        while (output_format < AUD_NUM_OUTPUT_FORMATS && strcmp(argv[5], output_format_names[output_format])) {
+            ++output_format;
+        }
+        if (output_format == AUD_NUM_OUTPUT_FORMATS) {
+            printf("Unknown output format %s\n", argv[5]);
+            return 20;
+        }
+    }
+
+    if (argc > 6) {
+        while (gain_mode < NUM_GAIN_MODES && strcmp(argv[6], gain_mode_names[gain_mode])) {
+            ++gain_mode;
+        }
+        if (gain_mode == NUM_GAIN_MODES) {
+            printf("Unknown gain mode %s\n", argv[6]);
+            return 20;
+        }
+    }
+
+    if (!load_trace(argv[1])) {
+        printf("Could not read %s\n", argv[1]);
+        free(trace_data);
+        return 20;
+    }
+
+    UWORD sample_rate_hz = 0;
+    UWORD update_rate_hz = 0;
+    UWORD packet_size    = 0;
+    ULONG first_event    = Aud_DecodeTraceHeader(
+        trace_data,
+        trace_size,
+        &sample_rate_hz,
+        &update_rate_hz,
+        &packet_size
+    );
+
+    if (!first_event) {
+        printf("%s is not a valid trace\n", argv[1]);
+        free(trace_data);
+        return 20;
+    }
+
+    int rc = 0;
+    Aud_Mixer* mixer = NULL;
+
+    if (!load_trace_sounds(first_event)) {
+        rc = 20;
+    } else if (!(mixer = Aud_CreateMixer(sample_rate_hz, update_rate_hz, group_size, output_format))) {
+        printf(
+            "Could not create %s mixer for %hu Hz / %hu Hz / %hu\n",
+            output_format_names[output_format],
+            sample_rate_hz,
+            update_rate_hz,
+            group_size
+        );
+        rc = 20;
+    } else if (GAIN_AGC == gain_mode && !Aud_EnableGainControl(mixer, TRUE)) {
+        printf("Gain control is not supported for %s output\n", output_format_names[output_format]);
+        rc = 20;
+    } else if (!init_clock()) {
+        puts("Could not open timer");
+        rc = 20;
+    } else {
+        printf(
+            "Replaying %s at %hu Hz / %hu Hz, %hu samples per packet in groups of %hu, %s output, %s gain\n",
+            argv[1],
+            sample_rate_hz,
+            update_rate_hz,
+            mixer->am_PacketSize,
+            mixer->am_GroupSize,
+            output_format_names[output_format],
+            gain_mode_names[gain_mode]
+        );
+        if (mixer->am_PacketSize != packet_size) {
+            printf(
+                "Recorded at %hu samples per packet, events will not fall at the same sample positions\n",
+                packet_size
+            );
+        }
+
+        for (size_t k = 0; k < NUM_KERNELS; ++k) {
+            if (strcmp(kernel_name, "all") && strcmp(kernel_name, kernels[k].name)) {
+                continue;
+            }
+
+            // Each kernel is replayed writing directly to Chip RAM and via the Fast RAM staging buffer
+            int num_modes = AUD_OUTPUT_PCM16 == output_format ? 1 : 2;
+            for (int staged = 0; staged < num_modes; ++staged) {
+                if (!Aud_SetStagedOutput(mixer, staged)) {
+                    puts("Could not allocate staging buffer");
+                    rc = 20;
+                    break;
+                }
+
+                ReplayResult result;
+                replay(mixer, &kernels[k], gain_mode, first_event, &result);
+
+                ULONG64 us     = (result.rr_ticks * 1000000) / clock_freq_hz;
+                ULONG64 max_us = (result.rr_maxTicks * 1000000) / clock_freq_hz;
+
+                printf(
+                    "%-12s %-6s %8lu packets %10lu us total %6lu us/packet %6lu us max checksum %08lx%s\n",
+                    kernels[k].name,
+                    staged ? "staged" : "direct",
+                    (unsigned long)result.rr_packets,
+                    (unsigned long)us,
+                    (unsigned long)(result.rr_packets ? us / result.rr_packets : 0),
+                    (unsigned long)max_us,
+                    (unsigned long)result.rr_checksum,
+                    (check_expected && result.rr_checksum != expected) ? " MISMATCH" : ""
+                );
+
+                if (result.rr_lost) {
+                    printf(
+                        "%-12s %-6s %8lu starts of unregistered sounds were not replayed\n",
+                        kernels[k].name,
+                        staged ? "staged" : "direct",
+                        (unsigned long)result.rr_lost
+                    );
+                }
+
+                if (check_expected && result.rr_checksum != expected) {
+                    rc = 10;
+                }
+            }
+        }
+        free_clock();
+    }
+
+    Aud_FreeMixer(mixer);
+    free_sounds();
+    free(trace_data);
+    return rc;
+}
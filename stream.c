@@ -0,0 +1,418 @@
+#include "stream.h"
+#include <stddef.h>
+#include <string.h>
+#ifndef AUD_HOST_BUILD
+#include <proto/exec.h>
+#include <proto/dos.h>
+#include <dos/dostags.h>
+#endif
+
+#define RING_MASK (AUD_STREAM_RING_SIZE - 1)
+
+/**
+ * Platform specifics: the file access, the loader task and the barrier needed when publishing loaded data to
+ * the mixer. On the 68K, the loader and mixer share a single CPU so no barrier is necessary.
+ */
+#ifdef AUD_HOST_BUILD
+
+#define PUBLISH() __sync_synchronize()
+
+static BOOL OpenSource(Aud_Stream* stream, char const* fileName)
+{
+    return NULL != (stream->as_File = fopen(fileName, "rb"));
+}
+
+static void CloseSource(Aud_Stream* stream)
+{
+    if (stream->as_File) {
+        fclose(stream->as_File);
+        stream->as_File = NULL;
+    }
+}
+
+static LONG ReadSource(Aud_Stream* stream, UBYTE* buffer, ULONG size)
+{
+    return (LONG)fread(buffer, 1, size, stream->as_File);
+}
+
+static void RewindSource(Aud_Stream* stream)
+{
+    fseek(stream->as_File, 0, SEEK_SET);
+}
+
+static void FillRing(Aud_Stream* stream);
+
+static void* LoaderThread(void* data)
+{
+    Aud_Stream* stream = (Aud_Stream*)data;
+    pthread_mutex_lock(&stream->as_Lock);
+    while (!stream->as_Quit) {
+        stream->as_WakePending = FALSE;
+        pthread_mutex_unlock(&stream->as_Lock);
+
+        FillRing(stream);
+
+        pthread_mutex_lock(&stream->as_Lock);
+        while (!stream->as_WakePending && !stream->as_Quit) {
+            pthread_cond_wait(&stream->as_Wake, &stream->as_Lock);
+        }
+    }
+    pthread_mutex_unlock(&stream->as_Lock);
+    return NULL;
+}
+
+static BOOL StartLoader(Aud_Stream* stream)
+{
+    pthread_mutex_init(&stream->as_Lock, NULL);
+    pthread_cond_init(&stream->as_Wake, NULL);
+    if (pthread_create(&stream->as_Thread, NULL, LoaderThread, stream)) {
+        pthread_cond_destroy(&stream->as_Wake);
+        pthread_mutex_destroy(&stream->as_Lock);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static void WakeLoader(Aud_Stream* stream)
+{
+    pthread_mutex_lock(&stream->as_Lock);
+    stream->as_WakePending = TRUE;
+    pthread_cond_signal(&stream->as_Wake);
+    pthread_mutex_unlock(&stream->as_Lock);
+}
+
+static void StopLoader(Aud_Stream* stream)
+{
+    pthread_mutex_lock(&stream->as_Lock);
+    stream->as_Quit = TRUE;
+    pthread_cond_signal(&stream->as_Wake);
+    pthread_mutex_unlock(&stream->as_Lock);
+
+    pthread_join(stream->as_Thread, NULL);
+    pthread_cond_destroy(&stream->as_Wake);
+    pthread_mutex_destroy(&stream->as_Lock);
+}
+
+#else
+
+#define PUBLISH()
+
+static BOOL OpenSource(Aud_Stream* stream, char const* fileName)
+{
+    return 0 != (stream->as_File = Open((STRPTR)fileName, MODE_OLDFILE));
+}
+
+static void CloseSource(Aud_Stream* stream)
+{
+    if (stream->as_File) {
+        Close(stream->as_File);
+        stream->as_File = 0;
+    }
+}
+
+static LONG ReadSource(Aud_Stream* stream, UBYTE* buffer, ULONG size)
+{
+    return Read(stream->as_File, buffer, size);
+}
+
+static void RewindSource(Aud_Stream* stream)
+{
+    Seek(stream->as_File, 0, OFFSET_BEGINNING);
+}
+
+static void FillRing(Aud_Stream* stream);
+
+/**
+ * Loader process entry point. The stream is passed in the startup message, which is replied to on exit. The
+ * loader refills the ring whenever the mixer signals that data have been released and quits on CTRL-C.
+ */
+static void LoaderProc(void)
+{
+    struct Process* self = (struct Process*)FindTask(NULL);
+    WaitPort(&self->pr_MsgPort);
+
+    struct Message* startup = GetMsg(&self->pr_MsgPort);
+    Aud_Stream*     stream  = (Aud_Stream*)((UBYTE*)startup - offsetof(Aud_Stream, as_StartupMsg));
+
+    ULONG signals = 0;
+    while (!(signals & SIGBREAKF_CTRL_C)) {
+        FillRing(stream);
+        signals = Wait(SIGBREAKF_CTRL_C | SIGBREAKF_CTRL_F);
+    }
+
+    // Make sure we are gone before the stream is freed
+    Forbid();
+    ReplyMsg(startup);
+}
+
+static BOOL StartLoader(Aud_Stream* stream)
+{
+    if (!(stream->as_ReplyPort = CreateMsgPort())) {
+        return FALSE;
+    }
+
+    stream->as_LoaderProc = CreateNewProcTags(
+        NP_Entry,    (ULONG)LoaderProc,
+        NP_Name,     (ULONG)"TKG Mixer Stream",
+        NP_Priority, AUD_STREAM_LOADER_PRI,
+        TAG_DONE
+    );
+
+    if (!stream->as_LoaderProc) {
+        DeleteMsgPort(stream->as_ReplyPort);
+        stream->as_ReplyPort = NULL;
+        return FALSE;
+    }
+
+    stream->as_StartupMsg.mn_ReplyPort = stream->as_ReplyPort;
+    stream->as_StartupMsg.mn_Length    = sizeof(struct Message);
+    PutMsg(&stream->as_LoaderProc->pr_MsgPort, &stream->as_StartupMsg);
+    return TRUE;
+}
+
+static void WakeLoader(Aud_Stream* stream)
+{
+    Signal(&stream->as_LoaderProc->pr_Task, SIGBREAKF_CTRL_F);
+}
+
+static void StopLoader(Aud_Stream* stream)
+{
+    stream->as_Quit = TRUE;
+    Signal(&stream->as_LoaderProc->pr_Task, SIGBREAKF_CTRL_C);
+    WaitPort(stream->as_ReplyPort);
+    GetMsg(stream->as_ReplyPort);
+    DeleteMsgPort(stream->as_ReplyPort);
+    stream->as_ReplyPort  = NULL;
+    stream->as_LoaderProc = NULL;
+}
+
+#endif
+
+/**
+ * Reads a whole chunk. At the end of the file, either rewinds to fill the rest of the chunk seamlessly, or pads
+ * it with silence and marks the end of the stream. Runs in the loader.
+ */
+static void LoadChunk(Aud_Stream* stream, UBYTE* chunk)
+{
+    ULONG loaded  = 0;
+    BOOL  rewound = FALSE;
+    while (loaded < AUD_STREAM_CHUNK_SIZE) {
+        LONG size = ReadSource(stream, chunk + loaded, AUD_STREAM_CHUNK_SIZE - loaded);
+        if (size > 0) {
+            loaded += size;
+            rewound = FALSE;
+            continue;
+        }
+
+        // End of file, or an error. Nothing read straight after rewinding means there is nothing to loop.
+        if ((stream->as_Flags & AUD_STREAM_LOOP) && !size && !rewound) {
+            RewindSource(stream);
+            rewound = TRUE;
+            continue;
+        }
+
+        memset(chunk + loaded, 0, AUD_STREAM_CHUNK_SIZE - loaded);
+        stream->as_BytesEnd    = stream->as_BytesLoaded + CacheAlign(loaded);
+        stream->as_EndOfSource = TRUE;
+        break;
+    }
+
+    if (stream->as_Flags & AUD_STREAM_PRE_ENCODED) {
+        // L1D15 encoding, as expected by Aud_MixPacket_040PreDelta
+        BYTE* frame = (BYTE*)chunk;
+        for (ULONG f = AUD_STREAM_CHUNK_SIZE >> 4; f > 0; --f) {
+            for (int i = CACHE_LINE_SIZE - 1; i > 0; --i) {
+                frame[i] -= frame[i - 1];
+            }
+            frame += CACHE_LINE_SIZE;
+        }
+    }
+}
+
+/**
+ * Loads chunks until the ring is full, the source ends or the stream is closed. Runs in the loader.
+ */
+static void FillRing(Aud_Stream* stream)
+{
+    while (!stream->as_Quit && !stream->as_EndOfSource) {
+        ULONG loaded = stream->as_BytesLoaded;
+        if (loaded - stream->as_BytesPlayed > AUD_STREAM_RING_SIZE - AUD_STREAM_CHUNK_SIZE) {
+            return;
+        }
+
+        ULONG  offset = loaded & RING_MASK;
+        UBYTE* chunk  = stream->as_RingPtr + offset;
+        LoadChunk(stream, chunk);
+
+        // Mirror the start of the ring after the end so that packets that wrap are contiguous
+        if (!offset) {
+            CopyMem(chunk, stream->as_RingPtr + AUD_STREAM_RING_SIZE, stream->as_MirrorSize);
+        }
+
+        PUBLISH();
+        stream->as_BytesLoaded = loaded + AUD_STREAM_CHUNK_SIZE;
+    }
+}
+
+BOOL Aud_OpenStream(
+    REG(a0, Aud_Mixer* mixer),
+    REG(a1, char const* fileName),
+    REG(d0, UWORD channel),
+    REG(d1, UWORD flags)
+)
+{
+    // The mirror must fit in the first chunk
+    if (mixer->am_StreamPtr || channel >= AUD_NUM_CHANNELS || mixer->am_PacketSize > AUD_STREAM_CHUNK_SIZE) {
+        return FALSE;
+    }
+
+    Aud_Stream* stream = (Aud_Stream*)AllocVec(sizeof(Aud_Stream), MEMF_ANY|MEMF_CLEAR);
+    if (!stream) {
+        return FALSE;
+    }
+
+    stream->as_Channel     = channel;
+    stream->as_Flags       = flags;
+    stream->as_LeftVolume  = 15;
+    stream->as_RightVolume = 15;
+    stream->as_MirrorSize  = CacheAlign(mixer->am_PacketSize);
+
+    stream->as_Stats.ss_RingBytes    = AUD_STREAM_RING_SIZE;
+    stream->as_Stats.ss_MinFillBytes = AUD_STREAM_RING_SIZE;
+
+    stream->as_RingPtr = (UBYTE*)AllocCacheAligned(AUD_STREAM_RING_SIZE + stream->as_MirrorSize, MEMF_FAST);
+    if (!stream->as_RingPtr) {
+        FreeVec(stream);
+        return FALSE;
+    }
+
+    if (!OpenSource(stream, fileName)) {
+        FreeCacheAligned(stream->as_RingPtr);
+        FreeVec(stream);
+        return FALSE;
+    }
+
+    if (!StartLoader(stream)) {
+        CloseSource(stream);
+        FreeCacheAligned(stream->as_RingPtr);
+        FreeVec(stream);
+        return FALSE;
+    }
+
+    // Take the channel over from any sound effect playing on it
+    Aud_ChannelState* state = &mixer->am_ChannelState[channel];
+    state->ac_SamplePtr   = NULL;
+    state->ac_SamplesLeft = 0;
+
+    mixer->am_StreamPtr = stream;
+    return TRUE;
+}
+
+void Aud_CloseStream(
+    REG(a0, Aud_Mixer* mixer)
+)
+{
+    Aud_Stream* stream = mixer->am_StreamPtr;
+    if (!stream) {
+        return;
+    }
+
+    StopLoader(stream);
+    CloseSource(stream);
+
+    Aud_ChannelState* state = &mixer->am_ChannelState[stream->as_Channel];
+    state->ac_SamplePtr   = NULL;
+    state->ac_SamplesLeft = 0;
+    state->ac_LeftVolume  = 0;
+    state->ac_RightVolume = 0;
+
+    mixer->am_StreamPtr = NULL;
+    FreeCacheAligned(stream->as_RingPtr);
+    FreeVec(stream);
+}
+
+void Aud_SetStreamVolume(
+    REG(a0, Aud_Mixer* mixer),
+    REG(d0, UWORD leftVolume),
+    REG(d1, UWORD rightVolume)
+)
+{
+    Aud_Stream* stream = mixer->am_StreamPtr;
+    if (stream) {
+        stream->as_LeftVolume  = (UBYTE)leftVolume;
+        stream->as_RightVolume = (UBYTE)rightVolume;
+    }
+}
+
+void Aud_UpdateStream(
+    REG(a0, Aud_Mixer* mixer)
+)
+{
+    Aud_Stream* stream = mixer->am_StreamPtr;
+    if (!stream) {
+        return;
+    }
+
+    Aud_ChannelState* state = &mixer->am_ChannelState[stream->as_Channel];
+    state->ac_SamplePtr   = NULL;
+    state->ac_SamplesLeft = 0;
+
+    // The previous packet has been mixed, so its data can be released to the loader
+    if (stream->as_Pending) {
+        stream->as_BytesPlayed += stream->as_Pending;
+        stream->as_Pending      = 0;
+        if (!stream->as_EndOfSource) {
+            WakeLoader(stream);
+        }
+    }
+
+    ++stream->as_Stats.ss_Packets;
+
+    BOOL  end_of_source = stream->as_EndOfSource;
+    ULONG played        = stream->as_BytesPlayed;
+    ULONG fill          = stream->as_BytesLoaded - played;
+    ULONG packet_size   = mixer->am_PacketSize;
+
+    stream->as_Stats.ss_FillBytes = fill;
+
+    if (end_of_source && (LONG)(played - stream->as_BytesEnd) >= 0) {
+        stream->as_Stats.ss_Finished = TRUE;
+        return;
+    }
+
+    // Play out whatever remains at the end, the rest of the packet is silent
+    if (end_of_source && stream->as_BytesEnd - played < packet_size) {
+        packet_size = stream->as_BytesEnd - played;
+    }
+
+    if (fill < packet_size) {
+        // Nothing is lost by a late start, or while the final chunk is being published
+        if (stream->as_Started && !end_of_source) {
+            ++stream->as_Stats.ss_Underruns;
+        }
+        return;
+    }
+
+    if (stream->as_Started && !end_of_source && fill < stream->as_Stats.ss_MinFillBytes) {
+        stream->as_Stats.ss_MinFillBytes = fill;
+    }
+    stream->as_Started = TRUE;
+
+    state->ac_SamplePtr   = (BYTE*)stream->as_RingPtr + (played & RING_MASK);
+    state->ac_SamplesLeft = (UWORD)packet_size;
+    state->ac_LeftVolume  = stream->as_LeftVolume;
+    state->ac_RightVolume = stream->as_RightVolume;
+    stream->as_Pending    = packet_size;
+}
+
+BOOL Aud_GetStreamStats(
+    REG(a0, Aud_Mixer* mixer),
+    REG(a1, Aud_StreamStats* stats)
+)
+{
+    if (!mixer->am_StreamPtr) {
+        return FALSE;
+    }
+    *stats = mixer->am_StreamPtr->as_Stats;
+    return TRUE;
+}
@@ -0,0 +1,133 @@
+#ifndef _TKG_STREAM_H_
+#define _TKG_STREAM_H_
+
+#include "mixer.h"
+
+#ifdef AUD_HOST_BUILD
+#include <stdio.h>
+#include <pthread.h>
+#else
+#include <exec/ports.h>
+#include <dos/dos.h>
+#include <dos/dosextens.h>
+#endif
+
+/**
+ * Music streaming
+ *
+ * A music stream plays a file of raw 8-bit signed sample data at the mixer rate, through one of the mixer
+ * channels that is reserved for it for as long as the stream is open. The data are read into a ring of cache
+ * aligned Fast RAM chunks by a separate loader task (a thread on the host) using plain sequential reads, so the
+ * mixer never waits on the disk.
+ *
+ * The chunks are contiguous, and the start of the ring is mirrored after the end whenever the first chunk is
+ * loaded. Each packet of stream data can therefore be handed to the mixer as a single run of samples, wherever
+ * it falls in the ring, and is mixed by the kernels exactly like any other channel.
+ *
+ * Aud_UpdateStream() must be called once before each packet is mixed. It releases the data mixed in the previous
+ * packet back to the loader and points the stream channel at the next packet. When the loader has not kept up,
+ * the packet is mixed without the stream and counted as an underrun.
+ */
+
+#define AUD_STREAM_CHUNK_SIZE 4096
+#define AUD_STREAM_NUM_CHUNKS 8 // Must be a power of 2
+#define AUD_STREAM_RING_SIZE  (AUD_STREAM_CHUNK_SIZE * AUD_STREAM_NUM_CHUNKS)
+
+// Stream flags
+#define AUD_STREAM_LOOP        1 // Restart from the beginning of the file at the end, rather than stopping
+#define AUD_STREAM_PRE_ENCODED 2 // L1D15 encode each chunk after loading, for Aud_MixPacket_040PreDelta
+
+#define AUD_STREAM_LOADER_PRI  1
+
+typedef struct {
+    ULONG ss_Packets;      // Packets mixed since the stream was opened
+    ULONG ss_Underruns;    // Packets mixed without stream data after playback started
+    ULONG ss_FillBytes;    // Bytes buffered ahead of the play position at the last update
+    ULONG ss_MinFillBytes; // Lowest fill level since playback started
+    ULONG ss_RingBytes;    // Capacity of the ring
+    BOOL  ss_Finished;     // The end of a non-looping stream has been played
+} Aud_StreamStats;
+
+typedef struct Aud_Stream {
+    UBYTE*         as_RingPtr;    // AUD_STREAM_RING_SIZE bytes, followed by the mirror of the start
+    ULONG          as_MirrorSize; // Bytes mirrored after the end of the ring, at least one packet
+
+    // Written by the loader only
+    volatile ULONG as_BytesLoaded;
+    volatile ULONG as_BytesEnd;   // Total stream length, once as_EndOfSource is set
+    volatile BOOL  as_EndOfSource;
+
+    // Written by the mixer side only
+    volatile ULONG as_BytesPlayed;
+    volatile BOOL  as_Quit;
+    ULONG          as_Pending;    // Bytes handed to the channel for the packet being mixed
+    UWORD          as_Channel;
+    UWORD          as_Flags;
+    UBYTE          as_LeftVolume;
+    UBYTE          as_RightVolume;
+    BOOL           as_Started;
+
+    Aud_StreamStats as_Stats;
+
+#ifdef AUD_HOST_BUILD
+    FILE*           as_File;
+    pthread_t       as_Thread;
+    pthread_mutex_t as_Lock;
+    pthread_cond_t  as_Wake;
+    BOOL            as_WakePending;
+#else
+    BPTR            as_File;
+    struct Process* as_LoaderProc;
+    struct MsgPort* as_ReplyPort;
+    struct Message  as_StartupMsg;
+#endif
+} Aud_Stream;
+
+/**
+ * Opens the named file and starts the loader, reserving the given channel for the stream. Playback starts once
+ * the first packet of data has been loaded. Returns FALSE on failure, or if a stream is already open.
+ */
+extern BOOL Aud_OpenStream(
+    REG(a0, Aud_Mixer* mixer),
+    REG(a1, char const* fileName),
+    REG(d0, UWORD channel),
+    REG(d1, UWORD flags)
+);
+
+/**
+ * Stops the loader, releases the ring and frees the reserved channel.
+ */
+extern void Aud_CloseStream(
+    REG(a0, Aud_Mixer* mixer)
+);
+
+extern void Aud_SetStreamVolume(
+    REG(a0, Aud_Mixer* mixer),
+    REG(d0, UWORD leftVolume),
+    REG(d1, UWORD rightVolume)
+);
+
+/**
+ * Call once before each packet is mixed.
+ */
+extern void Aud_UpdateStream(
+    REG(a0, Aud_Mixer* mixer)
+);
+
+/**
+ * Copies the current stream statistics. Returns FALSE if no stream is open.
+ */
+extern BOOL Aud_GetStreamStats(
+    REG(a0, Aud_Mixer* mixer),
+    REG(a1, Aud_StreamStats* stats)
+);
+
+/**
+ * Returns TRUE if the channel is reserved by an open stream, in which case the channel control functions ignore it.
+ */
+static inline BOOL Aud_IsStreamChannel(Aud_Mixer const* mixer, UWORD channel)
+{
+    return mixer->am_StreamPtr && mixer->am_StreamPtr->as_Channel == channel;
+}
+
+#endif
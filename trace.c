@@ -0,0 +1,263 @@
+#include "trace.h"
+#include <string.h>
+#ifndef AUD_HOST_BUILD
+#include <proto/exec.h>
+#endif
+
+static void PutWord(UBYTE* dst, UWORD value)
+{
+    dst[0] = (UBYTE)(value >> 8);
+    dst[1] = (UBYTE)value;
+}
+
+static UWORD GetWord(UBYTE const* src)
+{
+    return (UWORD)((src[0] << 8) | src[1]);
+}
+
+static void FlushTrace(Aud_Trace* trace)
+{
+    if (trace->at_BufferUsed) {
+        fwrite(trace->at_Buffer, 1, trace->at_BufferUsed, trace->at_File);
+        trace->at_BufferUsed = 0;
+    }
+}
+
+/**
+ * Appends an event to the buffer. Bridges any gap too large for the 16-bit delta with skip events first.
+ */
+static UBYTE* AppendEvent(Aud_Trace* trace, ULONG packet, UBYTE type, UWORD channel)
+{
+    ULONG delta = packet - trace->at_LastPacket;
+    while (delta > 0xFFFF) {
+        UBYTE* skip = AppendEvent(trace, trace->at_LastPacket + 0xFFFF, AUD_TRACE_SKIP, 0);
+        memset(skip + 3, 0, AUD_TRACE_EVENT_SIZE - 3);
+        delta -= 0xFFFF;
+    }
+
+    if (trace->at_BufferUsed + AUD_TRACE_EVENT_SIZE > sizeof(trace->at_Buffer)) {
+        FlushTrace(trace);
+    }
+
+    UBYTE* event = trace->at_Buffer + trace->at_BufferUsed;
+    trace->at_BufferUsed += AUD_TRACE_EVENT_SIZE;
+    trace->at_LastPacket  = packet;
+
+    PutWord(event, (UWORD)delta);
+    event[2] = (UBYTE)((type << 4) | (channel & 0x0F));
+    return event;
+}
+
+BOOL Aud_OpenTrace(
+    REG(a0, Aud_Mixer* mixer),
+    REG(a1, char const* fileName)
+)
+{
+    if (mixer->am_TracePtr) {
+        return FALSE;
+    }
+
+    Aud_Trace* trace = (Aud_Trace*)AllocVec(sizeof(Aud_Trace), MEMF_ANY|MEMF_CLEAR);
+    if (!trace) {
+        return FALSE;
+    }
+
+    if (!(trace->at_File = fopen(fileName, "wb"))) {
+        FreeVec(trace);
+        return FALSE;
+    }
+
+    UBYTE header[AUD_TRACE_HEADER_SIZE];
+    memcpy(header, AUD_TRACE_MAGIC, 4);
+    PutWord(header + 4,  AUD_TRACE_VERSION);
+    PutWord(header + 6,  mixer->am_SampleRateHz);
+    PutWord(header + 8,  mixer->am_UpdateRateHz);
+    PutWord(header + 10, mixer->am_PacketSize);
+    fwrite(header, 1, sizeof(header), trace->at_File);
+
+    trace->at_LastPacket = mixer->am_PacketCount;
+    mixer->am_TracePtr   = trace;
+    return TRUE;
+}
+
+void Aud_CloseTrace(
+    REG(a0, Aud_Mixer* mixer)
+)
+{
+    Aud_Trace* trace = mixer->am_TracePtr;
+    if (!trace) {
+        return;
+    }
+
+    UBYTE* event = AppendEvent(trace, mixer->am_PacketCount, AUD_TRACE_END, 0);
+    memset(event + 3, 0, AUD_TRACE_EVENT_SIZE - 3);
+    FlushTrace(trace);
+    fclose(trace->at_File);
+
+    mixer->am_TracePtr = NULL;
+    FreeVec(trace);
+}
+
+WORD Aud_TraceAddSound(
+    REG(a0, Aud_Mixer* mixer),
+    REG(a1, BYTE* samplePtr),
+    REG(a2, char const* name),
+    REG(d0, UWORD length)
+)
+{
+    Aud_Trace* trace = mixer->am_TracePtr;
+    if (!trace || trace->at_NumSounds == AUD_TRACE_MAX_SOUNDS) {
+        return -1;
+    }
+
+    size_t name_length = strlen(name);
+    if (name_length > AUD_TRACE_MAX_NAME) {
+        name_length = AUD_TRACE_MAX_NAME;
+    }
+
+    UWORD id = trace->at_NumSounds++;
+    trace->at_Sounds[id].ts_DataPtr = samplePtr;
+    trace->at_Sounds[id].ts_Length  = length;
+
+    UBYTE* event = AppendEvent(trace, mixer->am_PacketCount, AUD_TRACE_DEFINE, 0);
+    event[3] = (UBYTE)name_length;
+    PutWord(event + 4, id);
+    PutWord(event + 6, length);
+
+    if (trace->at_BufferUsed + name_length > sizeof(trace->at_Buffer)) {
+        FlushTrace(trace);
+    }
+    memcpy(trace->at_Buffer + trace->at_BufferUsed, name, name_length);
+    trace->at_BufferUsed += name_length;
+
+    return (WORD)id;
+}
+
+void Aud_TraceStart(
+    Aud_Trace* trace,
+    ULONG packet,
+    UWORD channel,
+    BYTE const* samplePtr,
+    UWORD length,
+    UWORD leftVolume,
+    UWORD rightVolume
+)
+{
+    UBYTE* event;
+
+    // Find the registered sound that contains the start address
+    for (UWORD id = 0; id < trace->at_NumSounds; ++id) {
+        Aud_TraceSound const* sound = &trace->at_Sounds[id];
+        if (samplePtr >= sound->ts_DataPtr && samplePtr < sound->ts_DataPtr + sound->ts_Length) {
+            event = AppendEvent(trace, packet, AUD_TRACE_START, channel);
+            event[3] = (UBYTE)((leftVolume << 4) | (rightVolume & 0x0F));
+            PutWord(event + 4, id);
+            PutWord(event + 6, (UWORD)(samplePtr - sound->ts_DataPtr));
+
+            event = AppendEvent(trace, packet, AUD_TRACE_LENGTH, channel);
+            memset(event + 3, 0, AUD_TRACE_EVENT_SIZE - 3);
+            PutWord(event + 6, length);
+            return;
+        }
+    }
+
+    // Unregistered sounds cannot be replayed, but the start still has to be accounted for
+    event = AppendEvent(trace, packet, AUD_TRACE_LOST, channel);
+    event[3] = (UBYTE)((leftVolume << 4) | (rightVolume & 0x0F));
+    memset(event + 4, 0, AUD_TRACE_EVENT_SIZE - 4);
+}
+
+void Aud_TraceStop(
+    Aud_Trace* trace,
+    ULONG packet,
+    UWORD channel
+)
+{
+    UBYTE* event = AppendEvent(trace, packet, AUD_TRACE_STOP, channel);
+    memset(event + 3, 0, AUD_TRACE_EVENT_SIZE - 3);
+}
+
+void Aud_TraceVolume(
+    Aud_Trace* trace,
+    ULONG packet,
+    UWORD channel,
+    UWORD leftVolume,
+    UWORD rightVolume
+)
+{
+    UBYTE* event = AppendEvent(trace, packet, AUD_TRACE_VOLUME, channel);
+    event[3] = (UBYTE)((leftVolume << 4) | (rightVolume & 0x0F));
+    memset(event + 4, 0, AUD_TRACE_EVENT_SIZE - 4);
+}
+
+ULONG Aud_DecodeTraceHeader(
+    UBYTE const* data,
+    ULONG size,
+    UWORD* sampleRateHz,
+    UWORD* updateRateHz,
+    UWORD* packetSize
+)
+{
+    if (
+        size < AUD_TRACE_HEADER_SIZE ||
+        0 != memcmp(data, AUD_TRACE_MAGIC, 4) ||
+        GetWord(data + 4) < 1 ||
+        GetWord(data + 4) > AUD_TRACE_VERSION ||
+        0 == GetWord(data + 10) ||
+        (GetWord(data + 10) & CACHE_ALIGN_MASK)
+    ) {
+        return 0;
+    }
+    *sampleRateHz = GetWord(data + 6);
+    *updateRateHz = GetWord(data + 8);
+    *packetSize   = GetWord(data + 10);
+    return AUD_TRACE_HEADER_SIZE;
+}
+
+ULONG Aud_DecodeTraceEvent(
+    UBYTE const* data,
+    ULONG size,
+    ULONG offset,
+    Aud_TraceEvent* event,
+    char* name
+)
+{
+    if (offset + AUD_TRACE_EVENT_SIZE > size) {
+        return 0;
+    }
+    data += offset;
+
+    event->te_Packet      += GetWord(data);
+    event->te_Type         = data[2] >> 4;
+    event->te_Channel      = data[2] & 0x0F;
+    event->te_LeftVolume   = data[3] >> 4;
+    event->te_RightVolume  = data[3] & 0x0F;
+    event->te_Sound        = GetWord(data + 4);
+    event->te_Offset       = GetWord(data + 6);
+    event->te_Length       = AUD_TRACE_NO_LENGTH;
+    offset += AUD_TRACE_EVENT_SIZE;
+
+    // Fold in the length of a start
+    if (
+        AUD_TRACE_START == event->te_Type &&
+        offset + AUD_TRACE_EVENT_SIZE <= size &&
+        0 == GetWord(data + AUD_TRACE_EVENT_SIZE) &&
+        AUD_TRACE_LENGTH == (data[AUD_TRACE_EVENT_SIZE + 2] >> 4)
+    ) {
+        event->te_Length = GetWord(data + AUD_TRACE_EVENT_SIZE + 6);
+        offset += AUD_TRACE_EVENT_SIZE;
+    }
+
+    if (AUD_TRACE_DEFINE == event->te_Type) {
+        UBYTE name_length = data[3];
+        if (name_length > AUD_TRACE_MAX_NAME || offset + name_length > size) {
+            return 0;
+        }
+        memcpy(name, data + AUD_TRACE_EVENT_SIZE, name_length);
+        name[name_length] = 0;
+        event->te_LeftVolume  = 0;
+        event->te_RightVolume = 0;
+        offset += name_length;
+    }
+    return offset;
+}
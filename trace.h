@@ -0,0 +1,168 @@
+#ifndef _TKG_TRACE_H_
+#define _TKG_TRACE_H_
+
+#include "mixer.h"
+#include <stdio.h>
+
+/**
+ * Sound event traces
+ *
+ * A trace records every channel start, stop and volume change made through the Aud_StartChannel(),
+ * Aud_StopChannel() and Aud_SetChannelVolume() calls, along with the index of the packet they were applied
+ * before. Replaying the trace against a mixer of the same sample and update rate reproduces the mix exactly.
+ * Starts of sample data outside of any registered sound cannot be replayed and are recorded as lost, so that the
+ * replay can report them and stop the channel rather than quietly under-representing the load.
+ *
+ * The file format is big endian throughout:
+ *
+ *   Header, AUD_TRACE_HEADER_SIZE bytes:
+ *     4 bytes  AUD_TRACE_MAGIC
+ *     UWORD    AUD_TRACE_VERSION
+ *     UWORD    sample rate (Hz)
+ *     UWORD    update rate (Hz)
+ *     UWORD    packet size (samples)
+ *
+ *   Followed by events, AUD_TRACE_EVENT_SIZE bytes each:
+ *     UWORD    packets elapsed since the previous event
+ *     UBYTE    event type << 4 | channel
+ *     UBYTE    left volume << 4 | right volume
+ *     UWORD    sound id
+ *     UWORD    offset into the sound, in samples
+ *
+ *   Each AUD_TRACE_START is followed by an AUD_TRACE_LENGTH event for the same packet, with the number of samples
+ *   started in the offset field. This may be 0, for a start of less than a line. Version 1 traces have no length
+ *   events and each start plays to the end of the sound.
+ *
+ *   An AUD_TRACE_LOST event records a start of unregistered sample data, with the volumes it was started at.
+ *
+ *   An AUD_TRACE_DEFINE event associates a sound id with a sound file name. The offset field holds the length
+ *   of the sound and the volume field holds the length of the name, which immediately follows the event.
+ *
+ *   Gaps of more than 65535 packets are bridged by AUD_TRACE_SKIP events. The final event is AUD_TRACE_END,
+ *   which carries the number of packets mixed after the last state change.
+ */
+
+#define AUD_TRACE_MAGIC         "TKGT"
+#define AUD_TRACE_VERSION       2
+#define AUD_TRACE_HEADER_SIZE   12
+#define AUD_TRACE_EVENT_SIZE    8
+#define AUD_TRACE_MAX_SOUNDS    256
+#define AUD_TRACE_MAX_NAME      31
+
+// te_Length of a start without a recorded length. Lengths are whole lines, so this is never recorded.
+#define AUD_TRACE_NO_LENGTH     0xFFFF
+
+// Events buffered in memory before being written out
+#define AUD_TRACE_BUFFER_EVENTS 512
+
+#define AUD_TRACE_DEFINE 0
+#define AUD_TRACE_START  1
+#define AUD_TRACE_STOP   2
+#define AUD_TRACE_VOLUME 3
+#define AUD_TRACE_LENGTH 4
+#define AUD_TRACE_LOST   5
+#define AUD_TRACE_SKIP   14
+#define AUD_TRACE_END    15
+
+typedef struct {
+    ULONG te_Packet;  // Absolute packet index the event applies before
+    UBYTE te_Type;
+    UBYTE te_Channel;
+    UBYTE te_LeftVolume;
+    UBYTE te_RightVolume;
+    UWORD te_Sound;
+    UWORD te_Offset;
+    UWORD te_Length;  // AUD_TRACE_START only, samples started or AUD_TRACE_NO_LENGTH to play to the end
+} Aud_TraceEvent;
+
+typedef struct {
+    BYTE* ts_DataPtr;
+    ULONG ts_Length;
+} Aud_TraceSound;
+
+typedef struct Aud_Trace {
+    FILE*          at_File;
+    ULONG          at_LastPacket;
+    UWORD          at_NumSounds;
+    ULONG          at_BufferUsed;
+    Aud_TraceSound at_Sounds[AUD_TRACE_MAX_SOUNDS];
+    UBYTE          at_Buffer[AUD_TRACE_BUFFER_EVENTS * AUD_TRACE_EVENT_SIZE];
+} Aud_Trace;
+
+/**
+ * Recording. Aud_OpenTrace() creates the trace file and attaches it to the mixer. Sounds must be registered with
+ * Aud_TraceAddSound() before they are played for their starts to be recorded. Aud_CloseTrace() writes the end
+ * marker and detaches the trace. Returns FALSE on failure.
+ */
+extern BOOL Aud_OpenTrace(
+    REG(a0, Aud_Mixer* mixer),
+    REG(a1, char const* fileName)
+);
+
+extern void Aud_CloseTrace(
+    REG(a0, Aud_Mixer* mixer)
+);
+
+extern WORD Aud_TraceAddSound(
+    REG(a0, Aud_Mixer* mixer),
+    REG(a1, BYTE* samplePtr),
+    REG(a2, char const* name),
+    REG(d0, UWORD length)
+);
+
+/**
+ * Event hooks, called by the channel control functions in mixer.c
+ */
+extern void Aud_TraceStart(
+    Aud_Trace* trace,
+    ULONG packet,
+    UWORD channel,
+    BYTE const* samplePtr,
+    UWORD length,
+    UWORD leftVolume,
+    UWORD rightVolume
+);
+
+extern void Aud_TraceStop(
+    Aud_Trace* trace,
+    ULONG packet,
+    UWORD channel
+);
+
+extern void Aud_TraceVolume(
+    Aud_Trace* trace,
+    ULONG packet,
+    UWORD channel,
+    UWORD leftVolume,
+    UWORD rightVolume
+);
+
+/**
+ * Playback. Decodes the header of a trace held in memory, returning the offset of the first event, or 0 if
+ * the data are not a valid trace. The packet size is the one the trace was recorded with, which a replay must
+ * match for the events to fall at the same sample positions.
+ */
+extern ULONG Aud_DecodeTraceHeader(
+    UBYTE const* data,
+    ULONG size,
+    UWORD* sampleRateHz,
+    UWORD* updateRateHz,
+    UWORD* packetSize
+);
+
+/**
+ * Decodes the event at the given offset. The event packet index is accumulated onto the te_Packet of the
+ * previous event, which should be 0 for the first call. For AUD_TRACE_DEFINE, the name is copied into name,
+ * which must have room for AUD_TRACE_MAX_NAME + 1 characters. The AUD_TRACE_LENGTH event following a start is
+ * decoded along with it, into te_Length. Returns the offset of the next event, or 0 at
+ * the end of the data or on error.
+ */
+extern ULONG Aud_DecodeTraceEvent(
+    UBYTE const* data,
+    ULONG size,
+    ULONG offset,
+    Aud_TraceEvent* event,
+    char* name
+);
+
+#endif